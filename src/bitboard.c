@@ -0,0 +1,157 @@
+//==============================================================================
+// Includes
+//==============================================================================
+
+#include "bitboard.h"
+
+#if defined(__AVX2__)
+    #include <immintrin.h>
+#elif defined(__SSE2__)
+    #include <emmintrin.h>
+#endif
+
+//==============================================================================
+// Functions
+//==============================================================================
+
+/**
+ * @brief Find the dead ends in a row of rooms, 64 rooms per word. A room is a
+ * dead end if exactly one of its four doors is open. Bit x of each row is room
+ * x, and each row must have a readable word before its first, which is zero
+ *
+ * @param right This row's doors to the right of each room
+ * @param down This row's doors below each room
+ * @param up The doors below each room in the row above, which are this row's
+ * doors above each room
+ * @param out Written with a set bit for each dead end
+ * @param numWords The number of words in the row
+ */
+void deadEndWords(const uint64_t* right, const uint64_t* down, const uint64_t* up, uint64_t* out, int numWords)
+{
+    int k = 0;
+
+#if defined(__AVX2__)
+    for (; k + 4 <= numWords; k += 4)
+    {
+        __m256i r = _mm256_loadu_si256((const __m256i*)&right[k]);
+        // The door to the left of room x is the door to the right of room x - 1
+        __m256i l = _mm256_or_si256(_mm256_slli_epi64(r, 1),
+                                    _mm256_srli_epi64(_mm256_loadu_si256((const __m256i*)&right[k - 1]), 63));
+        __m256i d = _mm256_loadu_si256((const __m256i*)&down[k]);
+        __m256i u = _mm256_loadu_si256((const __m256i*)&up[k]);
+
+        __m256i rl    = _mm256_or_si256(r, l);
+        __m256i du    = _mm256_or_si256(d, u);
+        __m256i any   = _mm256_or_si256(rl, du);
+        __m256i atTwo = _mm256_or_si256(_mm256_or_si256(_mm256_and_si256(r, l), _mm256_and_si256(d, u)),
+                                        _mm256_and_si256(rl, du));
+        _mm256_storeu_si256((__m256i*)&out[k], _mm256_andnot_si256(atTwo, any));
+    }
+#elif defined(__SSE2__)
+    for (; k + 2 <= numWords; k += 2)
+    {
+        __m128i r = _mm_loadu_si128((const __m128i*)&right[k]);
+        // The door to the left of room x is the door to the right of room x - 1
+        __m128i l
+            = _mm_or_si128(_mm_slli_epi64(r, 1), _mm_srli_epi64(_mm_loadu_si128((const __m128i*)&right[k - 1]), 63));
+        __m128i d = _mm_loadu_si128((const __m128i*)&down[k]);
+        __m128i u = _mm_loadu_si128((const __m128i*)&up[k]);
+
+        __m128i rl    = _mm_or_si128(r, l);
+        __m128i du    = _mm_or_si128(d, u);
+        __m128i any   = _mm_or_si128(rl, du);
+        __m128i atTwo = _mm_or_si128(_mm_or_si128(_mm_and_si128(r, l), _mm_and_si128(d, u)), _mm_and_si128(rl, du));
+        _mm_storeu_si128((__m128i*)&out[k], _mm_andnot_si128(atTwo, any));
+    }
+#endif
+
+    // Whatever is left, or everything without SIMD
+    for (; k < numWords; k++)
+    {
+        uint64_t r = right[k];
+        uint64_t l = (r << 1) | (right[k - 1] >> 63);
+        uint64_t d = down[k];
+        uint64_t u = up[k];
+
+        // At least one door is open, and no two are
+        uint64_t any   = r | l | d | u;
+        uint64_t atTwo = (r & l) | (d & u) | ((r | l) & (d | u));
+        out[k]         = any & ~atTwo;
+    }
+}
+
+/**
+ * @brief Find the first room of a run of rooms joined by unlocked doors
+ *
+ * @param doors The doors to the right of each room in the row
+ * @param locks The locked doors to the right of each room in the row
+ * @param x A room in the run
+ * @return The X coordinate of the leftmost room in the run
+ */
+int spanStart(const uint64_t* doors, const uint64_t* locks, int x)
+{
+    // Look for the last wall to the left of room x
+    int k        = x >> 6;
+    uint64_t bit = (uint64_t)1 << (x & 63);
+    uint64_t m   = ~(doors[k] & ~locks[k]) & (bit - 1);
+    while (0 == m)
+    {
+        if (0 == k)
+        {
+            return 0;
+        }
+        k--;
+        m = ~(doors[k] & ~locks[k]);
+    }
+    return (k << 6) + highestBit(m) + 1;
+}
+
+/**
+ * @brief Find the last room of a run of rooms joined by unlocked doors. The
+ * last room in the row must never have a door to its right
+ *
+ * @param doors The doors to the right of each room in the row
+ * @param locks The locked doors to the right of each room in the row
+ * @param x A room in the run
+ * @return The X coordinate of the rightmost room in the run
+ */
+int spanEnd(const uint64_t* doors, const uint64_t* locks, int x)
+{
+    // Look for the first wall at or to the right of room x
+    int k      = x >> 6;
+    uint64_t m = ~(doors[k] & ~locks[k]) & (~(uint64_t)0 << (x & 63));
+    while (0 == m)
+    {
+        k++;
+        m = ~(doors[k] & ~locks[k]);
+    }
+    return (k << 6) + lowestBit(m);
+}
+
+/**
+ * @brief Get the bits of one word which are in a run of rooms
+ *
+ * @param start The X coordinate of the first room in the run
+ * @param end The X coordinate of the last room in the run
+ * @param word The index of the word
+ * @return A mask of the rooms in the run, zero if the run misses the word
+ */
+uint64_t spanMask(int start, int end, int word)
+{
+    int lo = start - (word << 6);
+    int hi = end - (word << 6);
+    if (hi < 0 || lo > 63)
+    {
+        return 0;
+    }
+    uint64_t mask = ~(uint64_t)0;
+    if (lo > 0)
+    {
+        mask &= ~(uint64_t)0 << lo;
+    }
+    if (hi < 63)
+    {
+        mask &= ~(~(uint64_t)0 << (hi + 1));
+    }
+    return mask;
+}
@@ -0,0 +1,61 @@
+#ifndef _BITBOARD_H_
+#define _BITBOARD_H_
+
+#include <stdint.h>
+
+//==============================================================================
+// Functions
+//==============================================================================
+
+void deadEndWords(const uint64_t* right, const uint64_t* down, const uint64_t* up, uint64_t* out, int numWords);
+int spanStart(const uint64_t* doors, const uint64_t* locks, int x);
+int spanEnd(const uint64_t* doors, const uint64_t* locks, int x);
+uint64_t spanMask(int start, int end, int word);
+
+//==============================================================================
+// Inline functions
+//==============================================================================
+
+/**
+ * @brief Get the index of the lowest set bit of a word
+ *
+ * @param word The word, must not be zero
+ * @return The index of the lowest set bit, 0 to 63
+ */
+static inline int lowestBit(uint64_t word)
+{
+#if defined(__GNUC__)
+    return __builtin_ctzll(word);
+#else
+    int bit = 0;
+    while (0 == (word & 1))
+    {
+        word >>= 1;
+        bit++;
+    }
+    return bit;
+#endif
+}
+
+/**
+ * @brief Get the index of the highest set bit of a word
+ *
+ * @param word The word, must not be zero
+ * @return The index of the highest set bit, 0 to 63
+ */
+static inline int highestBit(uint64_t word)
+{
+#if defined(__GNUC__)
+    return 63 - __builtin_clzll(word);
+#else
+    int bit = 63;
+    while (0 == (word & ((uint64_t)1 << 63)))
+    {
+        word <<= 1;
+        bit--;
+    }
+    return bit;
+#endif
+}
+
+#endif
@@ -1,12 +1,16 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <time.h>
 #include <stdint.h>
+#include <inttypes.h>
 #include <string.h>
 #include <unistd.h>
 #include <ctype.h>
 #include <getopt.h>
+#include <pthread.h>
 
 #include "dungeon.h"
 #include "linked_list.h"
@@ -23,6 +27,84 @@
 // Eagle's Tower	34
 // Turtle Rock		46
 
+//==============================================================================
+// Structs
+//==============================================================================
+
+/**
+ * @brief A function which connects all rooms in a dungeon. It returns false if there wasn't enough memory
+ */
+typedef bool (*connectFn_t)(genCtx_t* ctx, dungeon_t* dungeon);
+
+/**
+ * @brief A maze generation algorithm which can be chosen from the command line
+ */
+typedef struct
+{
+    const char* name;
+    connectFn_t connect;
+} algorithm_t;
+
+/**
+ * @brief Everything needed to generate and save one dungeon
+ */
+typedef struct
+{
+    int width;
+    int height;
+    int roomWidth;
+    int roomHeight;
+    startingRoom_t startingRoom;
+    bool carveWalls;
+    /** Key type and order */
+    char* keyStr;
+    /** Save file name */
+    char* name;
+    /** Random seed */
+    uint64_t seed;
+    /** Maze generation algorithm */
+    connectFn_t connect;
+    /** Threads the algorithm may use */
+    int numThreads;
+    /** The width and height of each room in the PNG image, in pixels */
+    int roomPixels;
+} genJob_t;
+
+/**
+ * @brief A list of jobs shared between batch worker threads
+ */
+typedef struct
+{
+    genJob_t* jobs;
+    int numJobs;
+    /** The index of the next job to hand out */
+    int nextJob;
+    /** The number of heap allocations made while generating, over all jobs */
+    uint64_t numAllocs;
+    /** The number of jobs which couldn't be generated */
+    int numFailed;
+    /** Seconds spent encoding and writing RMD files, over all jobs */
+    double rmdEncodeTime;
+    double rmdWriteTime;
+    pthread_mutex_t lock;
+} jobQueue_t;
+
+//==============================================================================
+// Variables
+//==============================================================================
+
+static const algorithm_t algorithms[] = {
+    {"ellers", connectDungeonEllers},
+    {"backtracker", connectDungeonRecursive},
+    {"kruskal", connectDungeonKruskal},
+    {"wilson", connectDungeonWilson},
+    {"tiled", connectDungeonTiled},
+};
+
+//==============================================================================
+// Functions
+//==============================================================================
+
 /**
  * @brief Helper function to print instructions and exit
  *
@@ -33,8 +115,11 @@ void printAndExit(char* progName)
     fprintf(stderr,
             "Usage: %s [-w width] [-h height] [-x room_width] [-y room_height] [-s starting_room] [-k key_string] [-c "
             "carve_walls] [-n "
-            "name]\n",
+            "name] [-S seed] [-a algorithm] [-j threads] [-p room_pixels] [-v] [--stream] [--map file]\n",
+            progName);
+    fprintf(stderr, "       %s --batch manifest [-j threads] [-S seed] [-a algorithm] [-p room_pixels] [-v]\n",
             progName);
+    fprintf(stderr, "       %s --bench [-j threads] [-S seed] [-a algorithm]\n", progName);
     fprintf(stderr, "    starting_room is one of TOP_LEFT, TOP_RIGHT, BOTTOM_LEFT, BOTTOM_RIGHT\n");
     fprintf(stderr, "    key_string represents the type and order of keys placed in the map.\n");
     fprintf(stderr, "    key_string may not contain duplicate chars.\n");
@@ -47,115 +132,98 @@ void printAndExit(char* progName)
     fprintf(stderr, "        l   = lava\n");
     fprintf(stderr, "        w   = water\n");
     fprintf(stderr, "        0-9 = small key\n");
+    fprintf(stderr, "    seed is optional. The same seed and arguments always generate the same dungeon.\n");
+    fprintf(stderr, "    algorithm is one of ellers (default), backtracker, kruskal, wilson, tiled\n");
+    fprintf(stderr, "    tiled connects 256x256 tiles with ellers on separate threads, then joins the tiles.\n");
+    fprintf(stderr, "    manifest has one job per line, blank lines and lines starting with # are ignored:\n");
+    fprintf(stderr, "        width height room_width room_height starting_room key_string carve_walls name [seed]\n");
+    fprintf(stderr, "    carve_walls is 0 or 1 in a manifest. Jobs without a seed use seed + line number.\n");
+    fprintf(stderr, "    threads defaults to the number of online CPUs. It is split between jobs in batch mode,\n");
+    fprintf(stderr, "    and used by tiled otherwise.\n");
+    fprintf(stderr, "    room_pixels is the size of each room in the PNG image, at least %d, %d by default.\n",
+            PNG_MIN_ROOM_PIXELS, PNG_ROOM_PIXELS);
+    fprintf(stderr, "    -v prints how many heap allocations were made while generating,\n");
+    fprintf(stderr, "    and how long RMD files took to encode and write.\n");
+    fprintf(stderr, "    --stream writes each row as soon as it is generated, using memory proportional to width.\n");
+    fprintf(stderr, "    Streamed dungeons have no locks or keys, so key_string is not needed. Only ellers can stream.\n");
+    fprintf(stderr, "    --bench times algorithms connecting square dungeons of increasing size.\n");
+    fprintf(stderr, "    All algorithms are compared unless one is chosen.\n");
+    fprintf(stderr, "    --map keeps the dungeon in file instead of RAM, so it may be bigger than RAM. file is\n");
+    fprintf(stderr, "    removed as soon as it is mapped, and needs about 48 bytes of free disk per room.\n");
     exit(EXIT_FAILURE);
 }
 
 /**
- * @brief Main function
+ * @brief Convert a starting room name to a startingRoom_t
  *
- * @param argc count of arguments
- * @param argv Array of string arguments
- * @return EXIT_FAILURE if there was an error, EXIT_SUCCESS if all is good
+ * @param str The name, one of TOP_LEFT, TOP_RIGHT, BOTTOM_LEFT, BOTTOM_RIGHT
+ * @param startingRoom [out] The converted starting room
+ * @return true if the name was valid, false if it was not
  */
-int main(int argc, char** argv)
+static bool parseStartingRoom(const char* str, startingRoom_t* startingRoom)
 {
-    // Dungeon size
-    int width                   = 0;
-    int height                  = 0;
-    int roomWidth               = 0;
-    int roomHeight              = 0;
-    bool carveWalls             = false;
-    startingRoom_t startingRoom = TOP_LEFT;
-    // Key type and order
-    char* keyStr = NULL;
-    // Save file name
-    char* name = NULL;
+    if (0 == strcmp(str, "TOP_LEFT"))
+    {
+        *startingRoom = TOP_LEFT;
+    }
+    else if (0 == strcmp(str, "TOP_RIGHT"))
+    {
+        *startingRoom = TOP_RIGHT;
+    }
+    else if (0 == strcmp(str, "BOTTOM_LEFT"))
+    {
+        *startingRoom = BOTTOM_LEFT;
+    }
+    else if (0 == strcmp(str, "BOTTOM_RIGHT"))
+    {
+        *startingRoom = BOTTOM_RIGHT;
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
 
-    // Read arguments
-    int opt;
-    while ((opt = getopt(argc, argv, "w:h:s:x:y:k:cn:")) != -1)
+/**
+ * @brief Convert an algorithm name to the algorithm
+ *
+ * @param str The name of the algorithm
+ * @param algorithm [out] The algorithm
+ * @return true if the name was valid, false if it was not
+ */
+static bool parseAlgorithm(const char* str, const algorithm_t** algorithm)
+{
+    for (size_t i = 0; i < sizeof(algorithms) / sizeof(algorithms[0]); i++)
     {
-        switch (opt)
+        if (0 == strcmp(str, algorithms[i].name))
         {
-            case 'w':
-            {
-                width = atoi(optarg);
-                break;
-            }
-            case 'h':
-            {
-                height = atoi(optarg);
-                break;
-            }
-            case 'x':
-            {
-                roomWidth = atoi(optarg);
-                break;
-            }
-            case 'y':
-            {
-                roomHeight = atoi(optarg);
-                break;
-            }
-            case 's':
-            {
-                if (0 == strcmp(optarg, "TOP_LEFT"))
-                {
-                    startingRoom = TOP_LEFT;
-                }
-                else if (0 == strcmp(optarg, "TOP_RIGHT"))
-                {
-                    startingRoom = TOP_RIGHT;
-                }
-                else if (0 == strcmp(optarg, "BOTTOM_LEFT"))
-                {
-                    startingRoom = BOTTOM_LEFT;
-                }
-                else if (0 == strcmp(optarg, "BOTTOM_RIGHT"))
-                {
-                    startingRoom = BOTTOM_RIGHT;
-                }
-                else
-                {
-                    printAndExit(argv[0]);
-                }
-                break;
-            }
-            case 'k':
-            {
-                keyStr = optarg;
-                break;
-            }
-            case 'c':
-            {
-                carveWalls = true;
-                break;
-            }
-            case 'n':
-            {
-                name = optarg;
-                break;
-            }
-            default:
-            {
-                printAndExit(argv[0]);
-            }
+            *algorithm = &algorithms[i];
+            return true;
         }
     }
+    return false;
+}
 
-    // Make sure all arguments are supplied
-    if (0 == width || 0 == height || 0 == roomWidth || 0 == roomHeight || NULL == keyStr || NULL == name)
+/**
+ * @brief Translate a key string to a list of keys
+ *
+ * @param keyStr The key string to translate
+ * @param goals [out] The keys, must have space for MAX_KEYS entries
+ * @return true if the key string was valid, false if it was empty, too long or
+ * had an unknown char
+ */
+static bool parseKeyString(const char* keyStr, keyType_t* goals)
+{
+    int numKeys = strlen(keyStr);
+    if (0 == numKeys || numKeys > MAX_KEYS)
     {
-        printAndExit(argv[0]);
+        return false;
     }
-
-    // Translate the key string to a list of keys
-    int numKeys = strlen(keyStr);
-    keyType_t goals[numKeys];
     for (int kIdx = 0; kIdx < numKeys; kIdx++)
     {
-        keyStr[kIdx] = tolower(keyStr[kIdx]);
-        switch (keyStr[kIdx])
+        char key = tolower((unsigned char)keyStr[kIdx]);
+        switch (key)
         {
             case 'g':
             {
@@ -211,28 +279,28 @@ int main(int argc, char** argv)
             case '9':
             {
                 // Numerals are KEY_8 through KEY_17
-                goals[kIdx] = KEY_8 + (keyStr[kIdx] - '0');
+                goals[kIdx] = KEY_8 + (key - '0');
                 break;
             }
             default:
             {
-                printAndExit(argv[0]);
+                return false;
             }
         }
     }
+    return true;
+}
 
-    // Use a different seed value so that we don't get same
-    // result each time we run this program
-    srand(time(NULL));
-
-    // Create and connect dungeon
-    dungeon_t dungeon;
-    initDungeon(&dungeon, width, height);
-    connectDungeonEllers(&dungeon);
-
-    // Place the start
+/**
+ * @brief Get the coordinates of a job's starting room
+ *
+ * @param job The job to get the starting room for
+ * @return The coordinates of the starting room
+ */
+static coord_t getStartRoom(const genJob_t* job)
+{
     coord_t startRoom;
-    switch (startingRoom)
+    switch (job->startingRoom)
     {
         default:
         case TOP_LEFT:
@@ -243,44 +311,698 @@ int main(int argc, char** argv)
         }
         case TOP_RIGHT:
         {
-            startRoom.x = width - 1;
+            startRoom.x = job->width - 1;
             startRoom.y = 0;
             break;
         }
         case BOTTOM_LEFT:
         {
             startRoom.x = 0;
-            startRoom.y = height - 1;
+            startRoom.y = job->height - 1;
             break;
         }
         case BOTTOM_RIGHT:
         {
-            startRoom.x = width - 1;
-            startRoom.y = height - 1;
+            startRoom.x = job->width - 1;
+            startRoom.y = job->height - 1;
             break;
         }
     }
-    dungeon.rooms[startRoom.x][startRoom.y].isStart = true;
+    return startRoom;
+}
+
+/**
+ * @brief Generate a dungeon and save it as PNG and RMD
+ *
+ * @param job The parameters of the dungeon to generate. The key string must
+ * already be validated with parseKeyString()
+ * @param dungeon The dungeon to generate into, reset to the job's size. It may
+ * be zeroed, or left over from the previous job so its memory is reused
+ * @param numAllocs [out] The number of heap allocations made while generating,
+ * not counting saving
+ * @param rmdStats [out] How long saving the RMD file took
+ * @return true if the dungeon was generated, false if it or its scratch memory couldn't be allocated, or its
+ * image couldn't be saved
+ */
+static bool runJob(const genJob_t* job, dungeon_t* dungeon, uint32_t* numAllocs, rmdStats_t* rmdStats)
+{
+    // Translate the key string to a list of keys
+    int numKeys = strlen(job->keyStr);
+    keyType_t goals[MAX_KEYS];
+    parseKeyString(job->keyStr, goals);
+
+    // Seed the generator. Each job has its own so that jobs may run in parallel
+    genCtx_t ctx;
+    initGenCtx(&ctx, job->seed);
+    ctx.numThreads = job->numThreads;
+
+    // Create and connect dungeon
+    uint32_t initAllocs = getDungeonAllocs(dungeon);
+    memset(rmdStats, 0, sizeof(rmdStats_t));
+    if (!resetDungeon(dungeon, job->width, job->height))
+    {
+        *numAllocs = 0;
+        return false;
+    }
+    bool generated = job->connect(&ctx, dungeon);
+
+    // Place the start
+    coord_t startRoom = getStartRoom(job);
+    dungeon->rooms[roomIdx(dungeon, startRoom.x, startRoom.y)].isStart = true;
 
     // Place locks to partition the dungeon
-    placeLocks(&dungeon, goals, numKeys, startRoom);
+    generated = generated && placeLocks(dungeon, goals, numKeys, startRoom);
 
     // Mark dead ends
-    markDeadEnds(&dungeon);
+    generated = generated && markDeadEnds(dungeon);
 
     // Place the keys randomly, in accessible locations
-    placeKeys(&dungeon, goals, numKeys);
+    generated = generated && placeKeys(&ctx, dungeon, goals, numKeys);
 
     // Mark the end, which is the furthest room in the last partition
-    markEnd(&dungeon, startRoom, goals[numKeys - 1]);
+    generated  = generated && markEnd(dungeon, startRoom, goals[numKeys - 1]);
+    *numAllocs = getDungeonAllocs(dungeon) - initAllocs;
+    if (!generated)
+    {
+        fprintf(stderr, "Ran out of memory generating %s!\n", job->name);
+        return false;
+    }
 
     // Save the image
-    saveDungeonPng(&dungeon, name);
+    bool saved = saveDungeonPng(dungeon, job->name, job->roomPixels);
 
     // Save as RMD
-    saveDungeonRmd(&dungeon, roomWidth, roomHeight, carveWalls, name);
+    saveDungeonRmd(dungeon, job->roomWidth, job->roomHeight, job->carveWalls, job->name, rmdStats);
+
+    return saved;
+}
+
+/**
+ * @brief Generate a dungeon one row at a time and save each row as PNG and RMD
+ * as soon as it is ready. Only a few rows are ever held in memory, so the
+ * height of the dungeon is unlimited. No locks or keys are placed.
+ *
+ * @param job The parameters of the dungeon to generate. The key string is ignored
+ * @return true if the image was saved, false if it couldn't be written
+ */
+static bool runStreamJob(const genJob_t* job)
+{
+    // Seed the generator
+    genCtx_t ctx;
+    initGenCtx(&ctx, job->seed);
+
+    // Open the outputs
+    pngDungeonStream_t png;
+    rmdDungeonStream_t rmd;
+    bool pngOpen = openDungeonPngStream(&png, job->name, job->width, job->height, job->roomPixels);
+    // The start is the only object
+    bool rmdOpen = openDungeonRmdStream(&rmd, job->name, job->width, job->height, job->roomWidth, job->roomHeight,
+                                        job->carveWalls, 1);
+
+    // Keep views of the row being written and the rows around it
+    roomView_t* views[3];
+    for (int i = 0; i < 3; i++)
+    {
+        views[i] = calloc(job->width, sizeof(roomView_t));
+    }
+
+    coord_t startRoom = getStartRoom(job);
+
+    ellersRow_t er;
+    initEllersRow(&er, job->width, job->height, NULL);
+    for (int y = 0; y <= job->height; y++)
+    {
+        // Generate the next row
+        if (y < job->height)
+        {
+            nextEllersRow(&ctx, &er);
+            getEllersRoomViews(&er, views[y % 3]);
+            if (y == startRoom.y)
+            {
+                views[y % 3][startRoom.x].isStart = true;
+            }
+        }
+
+        // Once the row below is known, write the row before it
+        if (y > 0)
+        {
+            int rowY      = y - 1;
+            rowView_t row = {
+                .w     = job->width,
+                .h     = job->height,
+                .y     = rowY,
+                .above = (rowY > 0) ? views[(rowY - 1) % 3] : NULL,
+                .row   = views[rowY % 3],
+                .below = (rowY < (job->height - 1)) ? views[(rowY + 1) % 3] : NULL,
+            };
+            if (pngOpen)
+            {
+                writeDungeonPngRow(&png, &row);
+            }
+            if (rmdOpen)
+            {
+                writeDungeonRmdRow(&rmd, &row);
+            }
+        }
+    }
+    freeEllersRow(&er);
+
+    // Free everything
+    for (int i = 0; i < 3; i++)
+    {
+        free(views[i]);
+    }
+    bool pngSaved = pngOpen && closeDungeonPngStream(&png);
+    if (rmdOpen)
+    {
+        closeDungeonRmdStream(&rmd);
+    }
+    return pngSaved;
+}
+
+/**
+ * @brief Read a batch manifest
+ *
+ * @param fileName The manifest to read
+ * @param baseSeed The seed for jobs which don't specify one, offset by line number
+ * @param connect The maze generation algorithm for all jobs
+ * @param roomPixels The size of each room in the PNG images for all jobs
+ * @param jobs [out] The jobs read. Free each job's strings and the list when done
+ * @param numJobs [out] The number of jobs read
+ * @return true if the whole manifest was read, false if there was an error
+ */
+static bool readManifest(const char* fileName, uint64_t baseSeed, connectFn_t connect, int roomPixels, genJob_t** jobs,
+                         int* numJobs)
+{
+    FILE* file = fopen(fileName, "r");
+    if (NULL == file)
+    {
+        fprintf(stderr, "Couldn't open %s for reading!\n", fileName);
+        return false;
+    }
+
+    *jobs       = NULL;
+    *numJobs    = 0;
+    int jobsLen = 0;
+    bool ok     = true;
+
+    char line[1024];
+    int lineNum = 0;
+    while (ok && fgets(line, sizeof(line), file))
+    {
+        lineNum++;
+
+        // Skip blank lines and comments
+        char* start = line;
+        while (isspace((unsigned char)*start))
+        {
+            start++;
+        }
+        if ('\0' == *start || '#' == *start)
+        {
+            continue;
+        }
+
+        genJob_t job = {0};
+        char startStr[32];
+        char keyStr[64];
+        char name[512];
+        int carve;
+        unsigned long long seed;
+        int numRead = sscanf(start, "%d %d %d %d %31s %63s %d %511s %llu", &job.width, &job.height, &job.roomWidth,
+                             &job.roomHeight, startStr, keyStr, &carve, name, &seed);
+        if (numRead < 8 || job.width <= 0 || job.height <= 0 || job.roomWidth <= 0 || job.roomHeight <= 0
+            || !parseStartingRoom(startStr, &job.startingRoom))
+        {
+            fprintf(stderr, "%s:%d: Malformed job\n", fileName, lineNum);
+            ok = false;
+            break;
+        }
+
+        keyType_t goals[MAX_KEYS];
+        if (!parseKeyString(keyStr, goals))
+        {
+            fprintf(stderr, "%s:%d: Invalid key string %s\n", fileName, lineNum, keyStr);
+            ok = false;
+            break;
+        }
+
+        job.carveWalls = (0 != carve);
+        job.seed       = (9 == numRead) ? (uint64_t)seed : baseSeed + lineNum;
+        job.connect    = connect;
+        job.numThreads = 1;
+        job.roomPixels = roomPixels;
+        job.keyStr     = strdup(keyStr);
+        job.name       = strdup(name);
+
+        // Grow the job list as necessary
+        if (*numJobs == jobsLen)
+        {
+            jobsLen = jobsLen ? (jobsLen * 2) : 64;
+            *jobs   = realloc(*jobs, jobsLen * sizeof(genJob_t));
+        }
+        (*jobs)[(*numJobs)++] = job;
+    }
+    fclose(file);
+
+    return ok;
+}
+
+/**
+ * @brief Free jobs read with readManifest()
+ *
+ * @param jobs The jobs to free
+ * @param numJobs The number of jobs
+ */
+static void freeManifest(genJob_t* jobs, int numJobs)
+{
+    for (int i = 0; i < numJobs; i++)
+    {
+        free(jobs[i].keyStr);
+        free(jobs[i].name);
+    }
+    free(jobs);
+}
+
+/**
+ * @brief Worker thread for batch mode. Takes jobs from the queue until it is empty
+ *
+ * @param arg The jobQueue_t to take jobs from
+ * @return NULL
+ */
+static void* batchWorker(void* arg)
+{
+    jobQueue_t* queue = arg;
+    // Reused for every job this thread runs, so same-sized jobs don't allocate
+    dungeon_t dungeon = {0};
+    while (true)
+    {
+        pthread_mutex_lock(&queue->lock);
+        int jobIdx = queue->nextJob++;
+        pthread_mutex_unlock(&queue->lock);
+
+        if (jobIdx >= queue->numJobs)
+        {
+            freeDungeon(&dungeon);
+            return NULL;
+        }
+        uint32_t numAllocs;
+        rmdStats_t rmdStats;
+        bool generated = runJob(&queue->jobs[jobIdx], &dungeon, &numAllocs, &rmdStats);
+
+        pthread_mutex_lock(&queue->lock);
+        queue->numAllocs += numAllocs;
+        queue->rmdEncodeTime += rmdStats.encodeTime;
+        queue->rmdWriteTime += rmdStats.writeTime;
+        if (!generated)
+        {
+            queue->numFailed++;
+        }
+        pthread_mutex_unlock(&queue->lock);
+    }
+}
+
+/**
+ * @brief Get the time from a clock in seconds
+ *
+ * @param clockId The clock to read
+ * @return The time in seconds
+ */
+static double getTimeS(clockid_t clockId)
+{
+    struct timespec ts;
+    clock_gettime(clockId, &ts);
+    return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+/**
+ * @brief Generate every dungeon in a manifest using a pool of worker threads
+ *
+ * @param fileName The manifest to read
+ * @param numThreads The number of worker threads to run
+ * @param baseSeed The seed for jobs which don't specify one
+ * @param connect The maze generation algorithm for all jobs
+ * @param roomPixels The size of each room in the PNG images for all jobs
+ * @param verbose true to print statistics on top of throughput
+ * @return EXIT_FAILURE if there was an error, EXIT_SUCCESS if all is good
+ */
+static int runBatch(const char* fileName, int numThreads, uint64_t baseSeed, connectFn_t connect, int roomPixels,
+                    bool verbose)
+{
+    jobQueue_t queue = {0};
+    if (!readManifest(fileName, baseSeed, connect, roomPixels, &queue.jobs, &queue.numJobs))
+    {
+        freeManifest(queue.jobs, queue.numJobs);
+        return EXIT_FAILURE;
+    }
+    pthread_mutex_init(&queue.lock, NULL);
+
+    // Don't start more threads than there are jobs
+    if (numThreads > queue.numJobs)
+    {
+        numThreads = queue.numJobs;
+    }
+
+    double wallStart = getTimeS(CLOCK_MONOTONIC);
+    double cpuStart  = getTimeS(CLOCK_PROCESS_CPUTIME_ID);
+
+    // Start as many threads as possible
+    int numStarted     = 0;
+    pthread_t* threads = calloc(numThreads, sizeof(pthread_t));
+    if (NULL != threads)
+    {
+        while (numStarted < numThreads && 0 == pthread_create(&threads[numStarted], NULL, batchWorker, &queue))
+        {
+            numStarted++;
+        }
+    }
+
+    // If any didn't start, work on the main thread too, until the queue is empty
+    if (numStarted < numThreads)
+    {
+        batchWorker(&queue);
+    }
+    for (int t = 0; t < numStarted; t++)
+    {
+        pthread_join(threads[t], NULL);
+    }
+    free(threads);
+
+    double wallTime = getTimeS(CLOCK_MONOTONIC) - wallStart;
+    double cpuTime  = getTimeS(CLOCK_PROCESS_CPUTIME_ID) - cpuStart;
+
+    // Report throughput
+    printf("%d jobs on %d threads in %.3fs\n", queue.numJobs, numThreads, wallTime);
+    if (wallTime > 0 && numThreads > 0)
+    {
+        printf("%.1f jobs/s, %.1f%% CPU utilisation\n", queue.numJobs / wallTime,
+               (100 * cpuTime) / (wallTime * numThreads));
+    }
+    if (verbose)
+    {
+        printf("%" PRIu64 " heap allocations while generating\n", queue.numAllocs);
+        printf("RMD files encoded in %.3fs and written in %.3fs, summed over all jobs\n", queue.rmdEncodeTime,
+               queue.rmdWriteTime);
+    }
+    if (0 != queue.numFailed)
+    {
+        fprintf(stderr, "%d jobs failed\n", queue.numFailed);
+    }
 
     // Free everything
+    pthread_mutex_destroy(&queue.lock);
+    freeManifest(queue.jobs, queue.numJobs);
+    return (0 == queue.numFailed) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/**
+ * @brief Time how long algorithms take to connect square dungeons of
+ * increasing size. Locks, keys and saving are not included. Stops early if a
+ * dungeon is too big to allocate
+ *
+ * @param seed The seed for the generator
+ * @param algorithm The algorithm to time, or NULL to compare all of them
+ * @param numThreads The number of threads algorithms may use
+ */
+static void runBench(uint64_t seed, const algorithm_t* algorithm, int numThreads)
+{
+    const int sizes[]        = {1024, 2048, 4096, 8192, 16384};
+    const int numAlgos       = (NULL != algorithm) ? 1 : (int)(sizeof(algorithms) / sizeof(algorithms[0]));
+    const algorithm_t* algos = (NULL != algorithm) ? algorithm : algorithms;
+
+    printf("%11s", "size");
+    for (int a = 0; a < numAlgos; a++)
+    {
+        printf(" %20s", algos[a].name);
+    }
+    printf("\n");
+
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+    {
+        for (int a = 0; a < numAlgos; a++)
+        {
+            genCtx_t ctx;
+            initGenCtx(&ctx, seed);
+            ctx.numThreads = numThreads;
+
+            dungeon_t dungeon;
+            if (!initDungeon(&dungeon, sizes[i], sizes[i]))
+            {
+                // Bigger dungeons won't fit either
+                return;
+            }
+            if (0 == a)
+            {
+                printf("%5dx%-5d", sizes[i], sizes[i]);
+            }
+
+            double start   = getTimeS(CLOCK_MONOTONIC);
+            bool connected = algos[a].connect(&ctx, &dungeon);
+            double elapsed = getTimeS(CLOCK_MONOTONIC) - start;
+            if (!connected)
+            {
+                // Bigger dungeons won't fit either
+                printf("\n");
+                freeDungeon(&dungeon);
+                return;
+            }
+
+            printf(" %8.3fs %7.2fM/s", elapsed, dungeon.numRooms / elapsed / 1e6);
+            freeDungeon(&dungeon);
+            fflush(stdout);
+        }
+        printf("\n");
+        fflush(stdout);
+    }
+}
+
+/**
+ * @brief Main function
+ *
+ * @param argc count of arguments
+ * @param argv Array of string arguments
+ * @return EXIT_FAILURE if there was an error, EXIT_SUCCESS if all is good
+ */
+int main(int argc, char** argv)
+{
+    genJob_t job = {
+        .width        = 0,
+        .height       = 0,
+        .roomWidth    = 0,
+        .roomHeight   = 0,
+        .carveWalls   = false,
+        .startingRoom = TOP_LEFT,
+        .keyStr       = NULL,
+        .name         = NULL,
+        // Random seed, defaults to the current time so that we don't get same
+        // result each time we run this program
+        .seed = (uint64_t)time(NULL),
+        // Eller's algorithm by default
+        .connect    = connectDungeonEllers,
+        .roomPixels = PNG_ROOM_PIXELS,
+    };
+    // Batch mode arguments
+    char* manifest = NULL;
+    int numThreads = sysconf(_SC_NPROCESSORS_ONLN);
+    // Streaming mode
+    bool stream = false;
+    // Benchmark mode
+    bool bench = false;
+    // The file to keep the dungeon in instead of RAM, if any
+    char* mapPath = NULL;
+    // Print statistics after generating
+    bool verbose = false;
+    // The algorithm named on the command line, if any
+    const algorithm_t* algorithm = NULL;
+
+    const struct option longOpts[] = {
+        {"batch", required_argument, NULL, 'b'},
+        {"stream", no_argument, NULL, 'r'},
+        {"bench", no_argument, NULL, 'B'},
+        {"map", required_argument, NULL, 'M'},
+        {NULL, 0, NULL, 0},
+    };
+
+    // Read arguments
+    int opt;
+    while ((opt = getopt_long(argc, argv, "w:h:s:x:y:k:cn:S:j:a:p:v", longOpts, NULL)) != -1)
+    {
+        switch (opt)
+        {
+            case 'w':
+            {
+                job.width = atoi(optarg);
+                break;
+            }
+            case 'h':
+            {
+                job.height = atoi(optarg);
+                break;
+            }
+            case 'x':
+            {
+                job.roomWidth = atoi(optarg);
+                break;
+            }
+            case 'y':
+            {
+                job.roomHeight = atoi(optarg);
+                break;
+            }
+            case 's':
+            {
+                if (!parseStartingRoom(optarg, &job.startingRoom))
+                {
+                    printAndExit(argv[0]);
+                }
+                break;
+            }
+            case 'k':
+            {
+                job.keyStr = optarg;
+                break;
+            }
+            case 'c':
+            {
+                job.carveWalls = true;
+                break;
+            }
+            case 'n':
+            {
+                job.name = optarg;
+                break;
+            }
+            case 'S':
+            {
+                job.seed = strtoull(optarg, NULL, 0);
+                break;
+            }
+            case 'b':
+            {
+                manifest = optarg;
+                break;
+            }
+            case 'j':
+            {
+                numThreads = atoi(optarg);
+                break;
+            }
+            case 'r':
+            {
+                stream = true;
+                break;
+            }
+            case 'a':
+            {
+                if (!parseAlgorithm(optarg, &algorithm))
+                {
+                    printAndExit(argv[0]);
+                }
+                job.connect = algorithm->connect;
+                break;
+            }
+            case 'p':
+            {
+                job.roomPixels = atoi(optarg);
+                if (job.roomPixels < PNG_MIN_ROOM_PIXELS)
+                {
+                    printAndExit(argv[0]);
+                }
+                break;
+            }
+            case 'v':
+            {
+                verbose = true;
+                break;
+            }
+            case 'B':
+            {
+                bench = true;
+                break;
+            }
+            case 'M':
+            {
+                mapPath = optarg;
+                break;
+            }
+            default:
+            {
+                printAndExit(argv[0]);
+            }
+        }
+    }
+
+    // Time the algorithm instead of generating a dungeon
+    if (bench)
+    {
+        if (numThreads < 1)
+        {
+            printAndExit(argv[0]);
+        }
+        runBench(job.seed, algorithm, numThreads);
+        exit(EXIT_SUCCESS);
+    }
+
+    // Run a whole batch of jobs instead of a single dungeon
+    if (NULL != manifest)
+    {
+        if (numThreads < 1)
+        {
+            printAndExit(argv[0]);
+        }
+        exit(runBatch(manifest, numThreads, job.seed, job.connect, job.roomPixels, verbose));
+    }
+
+    // Stream the dungeon instead of holding all of it in memory
+    if (stream)
+    {
+        // Only Eller's algorithm works one row at a time
+        if (job.width <= 0 || job.height <= 0 || job.roomWidth <= 0 || job.roomHeight <= 0 || NULL == job.name
+            || connectDungeonEllers != job.connect)
+        {
+            printAndExit(argv[0]);
+        }
+        exit(runStreamJob(&job) ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    // Make sure all arguments are supplied
+    if (0 == job.width || 0 == job.height || 0 == job.roomWidth || 0 == job.roomHeight || NULL == job.keyStr
+        || NULL == job.name)
+    {
+        printAndExit(argv[0]);
+    }
+
+    // Make sure the key string is valid
+    keyType_t goals[MAX_KEYS];
+    if (!parseKeyString(job.keyStr, goals))
+    {
+        printAndExit(argv[0]);
+    }
+
+    // Generate and save the dungeon
+    if (numThreads < 1)
+    {
+        printAndExit(argv[0]);
+    }
+    job.numThreads = numThreads;
+    dungeon_t dungeon = {0};
+    if (NULL != mapPath)
+    {
+        mapDungeonToFile(&dungeon, mapPath);
+    }
+    uint32_t numAllocs;
+    rmdStats_t rmdStats;
+    if (!runJob(&job, &dungeon, &numAllocs, &rmdStats))
+    {
+        freeDungeon(&dungeon);
+        exit(EXIT_FAILURE);
+    }
+    if (verbose)
+    {
+        printf("%" PRIu32 " heap allocations while generating\n", numAllocs);
+        printf("RMD encoded in %.3fs and written in %.3fs, %zu bytes\n", rmdStats.encodeTime, rmdStats.writeTime,
+               rmdStats.size);
+    }
     freeDungeon(&dungeon);
 
     // Exit
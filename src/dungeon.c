@@ -2,12 +2,19 @@
 // Includes
 //==============================================================================
 
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <inttypes.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
 #include "rayTypes.h"
 
-#include "linked_list.h"
+#include "bitboard.h"
 #include "dungeon.h"
 
 //==============================================================================
@@ -15,19 +22,62 @@
 //==============================================================================
 
 #ifdef DBG_PRINT
-void printRow(int y, int width, room_t** rooms);
+void printRow(const ellersRow_t* er);
 #endif
 
-void mergeSets(dungeon_t* dungeon, int x, int y);
-void fisherYates(int* arr, int len);
+static void* allocDungeonMem(dungeon_t* dungeon, size_t size);
+static void freeDungeonMem(dungeon_t* dungeon);
+static int32_t findSet(ellersRow_t* er, int32_t set);
+static bool unionSets(ellersRow_t* er, int32_t a, int32_t b);
+bool isLocked(keyType_t lock);
+static bool fillPartition(dungeon_t* dungeon, int32_t startingRoom, keyType_t partition);
+static int32_t findRoomSet(int32_t* parent, int32_t room);
+static bool unionRoomSets(int32_t* parent, int32_t a, int32_t b);
+static void connectEllersTile(genCtx_t* ctx, dungeon_t* dungeon, int x0, int y0, int tw, int th, void* rowMem);
+void fisherYates(genCtx_t* ctx, int* arr, int len);
 
 //==============================================================================
 // Defines
 //==============================================================================
 
-#define COORDS_TO_LIST(x, y) ((void*)((intptr_t)(((x) << 16) | (y))))
-#define LIST_TO_X(c)         ((((intptr_t)(c)) >> 16) & 0xFFFF)
-#define LIST_TO_Y(c)         ((((intptr_t)(c)) >> 0) & 0xFFFF)
+// Alignment for each of a dungeon's arrays, a cache line
+#define DUNGEON_ALIGN 64
+#define ALIGN_UP(n)   (((n) + DUNGEON_ALIGN - 1) & ~((size_t)DUNGEON_ALIGN - 1))
+
+// The width and height of each tile for connectDungeonTiled(), in rooms
+#define TILE_SIZE 256
+
+// Scratch memory reserved per room, enough for placeLocks() and the fillPartition() inside it
+#define SCRATCH_PER_ROOM ((6 * sizeof(int32_t)) + sizeof(bool))
+
+//==============================================================================
+// Structs
+//==============================================================================
+
+/**
+ * @brief Tiles of a dungeon shared between connectDungeonTiled() worker threads
+ */
+typedef struct
+{
+    dungeon_t* dungeon;
+    /** Tile t is generated with seed + t */
+    uint64_t seed;
+    int tilesX;
+    int numTiles;
+    /** The index of the next tile to hand out */
+    int nextTile;
+    pthread_mutex_t lock;
+} tileQueue_t;
+
+/**
+ * @brief A connectDungeonTiled() worker thread's state
+ */
+typedef struct
+{
+    tileQueue_t* queue;
+    /** Memory for Eller's algorithm on one tile, see ellersRowSize() */
+    void* rowMem;
+} tileWorker_t;
 
 //==============================================================================
 // Variables
@@ -46,267 +96,1221 @@ const coord_t cardinals[DOOR_MAX] = {
 //==============================================================================
 
 /**
- * @brief TODO doc
+ * @brief Initialize a generator context
  *
- * @param dungeon
- * @param width
- * @param height
+ * @param ctx The context to initialize
+ * @param seed The seed for the context's random number generator. The same seed
+ * always generates the same dungeon
  */
-void initDungeon(dungeon_t* dungeon, int width, int height)
+void initGenCtx(genCtx_t* ctx, uint64_t seed)
 {
+    rngSeed(&ctx->rng, seed);
+    ctx->numThreads = 1;
+}
+
+/**
+ * @brief Point each of a dungeon's arrays into a block of memory
+ *
+ * @param dungeon The dungeon to lay out. w, h, numRooms and numDoors must be set
+ * @param mem The block of memory, or NULL to only measure how big it must be
+ * @return The size of the block of memory, in bytes
+ */
+static size_t layoutDungeon(dungeon_t* dungeon, uint8_t* mem)
+{
+    size_t size = 0;
+#define CARVE(field, count)                                          \
+    dungeon->field = (NULL != mem) ? (void*)(mem + size) : NULL;     \
+    size += ALIGN_UP((size_t)(count) * sizeof(*dungeon->field))
+
+    // Rooms
+    CARVE(rooms, dungeon->numRooms);
+
+    // Doors
+    CARVE(lock, dungeon->numDoors);
+
+    // Bitboards, with an extra row of zeros above the first
+    size_t boardWords = (size_t)(dungeon->h + 1) * dungeon->boardStride;
+    CARVE(rightBoard, boardWords);
+    CARVE(downBoard, boardWords);
+    CARVE(rightLockBoard, boardWords);
+    CARVE(downLockBoard, boardWords);
+
+    // Traversal state
+    CARVE(dist, dungeon->numRooms);
+    CARVE(numChildren, dungeon->numRooms);
+    CARVE(doorNumChildren, dungeon->numDoors);
+    CARVE(visitStamp, dungeon->numRooms);
+
+#undef CARVE
+    return size;
+}
+
+/**
+ * @brief Initialize a dungeon where every room is walled off from every other
+ *
+ * @param dungeon The dungeon to initialize
+ * @param width The width of the dungeon, in rooms
+ * @param height The height of the dungeon, in rooms
+ * @return true if the dungeon was allocated, false if it is too big or there
+ * wasn't enough memory
+ */
+bool initDungeon(dungeon_t* dungeon, int width, int height)
+{
+    memset(dungeon, 0, sizeof(dungeon_t));
+    return resetDungeon(dungeon, width, height);
+}
+
+/**
+ * @brief Re-initialize a dungeon in place, possibly with a new size, so every
+ * room is walled off again. The rooms, doors and scratch memory share one
+ * block, which is only reallocated if it is too small for the new size. A
+ * dungeon zeroed with memset() may also be reset, which allocates it
+ *
+ * @param dungeon The dungeon to reset
+ * @param width The width of the dungeon, in rooms
+ * @param height The height of the dungeon, in rooms
+ * @return true if the dungeon was allocated, false if it is too big or there
+ * wasn't enough memory
+ */
+bool resetDungeon(dungeon_t* dungeon, int width, int height)
+{
+    // Every room and door must have an index
+    if (width <= 0 || height <= 0 || (int64_t)width * height > MAX_DUNGEON_ROOMS)
+    {
+        fprintf(stderr, "A %dx%d dungeon is not allowed, it must have between 1 and %d rooms!\n", width, height,
+                MAX_DUNGEON_ROOMS);
+        return false;
+    }
+
     // Save width and height
-    dungeon->w = width;
-    dungeon->h = height;
+    dungeon->w        = width;
+    dungeon->h        = height;
+    dungeon->numRooms = width * height;
+    // Each room owns the doors to its right and below it
+    dungeon->numDoors = 2 * dungeon->numRooms;
+#ifdef MORTON_LAYOUT
+    // Interleaving only covers every index without gaps if both sides are powers of two
+    if (0 != (width & (width - 1)) || 0 != (height & (height - 1)))
+    {
+        fprintf(stderr, "A %dx%d dungeon can't use MORTON_LAYOUT, the width and height must be powers of two!\n",
+                width, height);
+        return false;
+    }
+    dungeon->mortonBits = 0;
+    while ((1 << (dungeon->mortonBits + 1)) <= MIN(width, height))
+    {
+        dungeon->mortonBits++;
+    }
+    uint32_t lowMask  = ((uint32_t)1 << (2 * dungeon->mortonBits)) - 1;
+    uint32_t highMask = (uint32_t)(dungeon->numRooms - 1) & ~lowMask;
+    dungeon->xMask    = (0x55555555 & lowMask) | ((width > height) ? highMask : 0);
+    dungeon->yMask    = (0xAAAAAAAA & lowMask) | ((height > width) ? highMask : 0);
+#endif
+    // A leading zero word, then enough words for a bit per room
+    dungeon->boardStride = 1 + ((width + 63) / 64);
+
+    // Reserve scratch memory for traversals after the arrays, so generating doesn't allocate
+    size_t arraySize   = layoutDungeon(dungeon, NULL);
+    size_t scratchSize = ALIGN_UP((dungeon->numRooms * SCRATCH_PER_ROOM) + ellersRowSize(width))
+                         + ALIGN_UP(dungeon->boardStride * sizeof(uint64_t)) + (16 * DUNGEON_ALIGN);
+    // If the scratch had to grow last time, keep the room it grew into
+    if (dungeon->scratch.ownsMem && dungeon->scratch.size > scratchSize)
+    {
+        scratchSize = dungeon->scratch.size;
+    }
+    dungeon->numAllocs += dungeon->scratch.numAllocs;
+    freeScratch(&dungeon->scratch);
+
+    if (arraySize + scratchSize > dungeon->capacity)
+    {
+        // Too small, allocate everything at once
+        freeDungeonMem(dungeon);
+        dungeon->capacity = arraySize + scratchSize;
+        dungeon->mem      = allocDungeonMem(dungeon, dungeon->capacity);
+        if (NULL == dungeon->mem)
+        {
+            fprintf(stderr, "Couldn't allocate a %dx%d dungeon!\n", width, height);
+            dungeon->capacity = 0;
+            return false;
+        }
+        dungeon->numAllocs++;
+    }
+    else
+    {
+        // Big enough, only the arrays need clearing
+        memset(dungeon->mem, 0, arraySize);
+    }
+    layoutDungeon(dungeon, dungeon->mem);
+    dungeon->visitEpoch = 0;
+    initScratch(&dungeon->scratch, (uint8_t*)dungeon->mem + arraySize, dungeon->capacity - arraySize);
+    return true;
+}
+
+/**
+ * @brief Keep a dungeon's rooms, doors and scratch memory in a file mapped into
+ * memory instead of on the heap, so the dungeon may be bigger than RAM. Pages
+ * are written out to the file when memory runs low, and read back in when
+ * touched. The file is removed as soon as it is mapped, so its space is given
+ * back when the dungeon is freed or the program exits. Must be called before
+ * the dungeon is first reset
+ *
+ * @param dungeon The dungeon to map, zeroed with memset()
+ * @param path The file to map, which is created or truncated. It should be on
+ * a disk with enough free space for the whole dungeon
+ */
+void mapDungeonToFile(dungeon_t* dungeon, const char* path)
+{
+    dungeon->mapPath = path;
+}
 
-    // Allocate rows
-    dungeon->rooms = (room_t**)calloc(width, sizeof(room_t*));
-    // Allocate columns
-    for (int i = 0; i < width; i++)
+/**
+ * @brief Allocate zeroed memory for a dungeon, from the heap or by mapping its
+ * file, see mapDungeonToFile()
+ *
+ * @param dungeon The dungeon to allocate for
+ * @param size The number of bytes to allocate
+ * @return The memory, or NULL if it couldn't be allocated
+ */
+static void* allocDungeonMem(dungeon_t* dungeon, size_t size)
+{
+    if (NULL == dungeon->mapPath)
     {
-        dungeon->rooms[i] = (room_t*)calloc(height, sizeof(room_t));
+        return calloc(1, size);
     }
 
-    // Allocate doors
-    dungeon->numDoors = (width * (height - 1)) + ((width - 1) * height);
-    dungeon->doors    = calloc(dungeon->numDoors, sizeof(door_t));
-    int doorIdx       = 0;
+    // A new file reads as zeros, and the disk space is only used as pages are written
+    int fd = open(dungeon->mapPath, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        fprintf(stderr, "Couldn't open %s to map a dungeon!\n", dungeon->mapPath);
+        return NULL;
+    }
+    void* mem = NULL;
+    if (0 == ftruncate(fd, (off_t)size))
+    {
+        mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        mem = (MAP_FAILED == mem) ? NULL : mem;
+    }
+    if (NULL == mem)
+    {
+        fprintf(stderr, "Couldn't map %zu bytes of %s!\n", size, dungeon->mapPath);
+    }
 
-    // Connect left/right doors
-    for (int y = 0; y < height; y++)
+    // The mapping keeps the file alive without its name or descriptor
+    close(fd);
+    unlink(dungeon->mapPath);
+    return mem;
+}
+
+/**
+ * @brief Free the memory allocated by allocDungeonMem()
+ *
+ * @param dungeon The dungeon to free the memory of
+ */
+static void freeDungeonMem(dungeon_t* dungeon)
+{
+    if (NULL == dungeon->mem)
     {
-        for (int x = 0; x < width - 1; x++)
+        return;
+    }
+    if (NULL == dungeon->mapPath)
+    {
+        free(dungeon->mem);
+    }
+    else
+    {
+        munmap(dungeon->mem, dungeon->capacity);
+    }
+}
+
+/**
+ * @brief Get the number of heap allocations a dungeon has made since it was
+ * initialized, including its scratch memory
+ *
+ * @param dungeon The dungeon to count allocations for
+ * @return The number of heap allocations
+ */
+uint32_t getDungeonAllocs(const dungeon_t* dungeon)
+{
+    return dungeon->numAllocs + dungeon->scratch.numAllocs;
+}
+
+/**
+ * @brief Free a dungeon
+ *
+ * @param dungeon The dungeon to free
+ */
+void freeDungeon(dungeon_t* dungeon)
+{
+    freeScratch(&dungeon->scratch);
+    freeDungeonMem(dungeon);
+    dungeon->mem      = NULL;
+    dungeon->capacity = 0;
+}
+
+/**
+ * @brief Connect all rooms in a dungeon with Eller's algorithm, which
+ * generates a perfect maze one row at a time
+ *
+ * @param ctx The generator to get random numbers from
+ * @param dungeon The dungeon to connect
+ * @return true if the dungeon was connected, false if there wasn't enough memory
+ */
+bool connectDungeonEllers(genCtx_t* ctx, dungeon_t* dungeon)
+{
+    scratchMark_t mark = scratchMark(&dungeon->scratch);
+    void* rowMem       = scratchAlloc(&dungeon->scratch, ellersRowSize(dungeon->w));
+    if (NULL == rowMem)
+    {
+        return false;
+    }
+    connectEllersTile(ctx, dungeon, 0, 0, dungeon->w, dungeon->h, rowMem);
+    scratchRelease(&dungeon->scratch, mark);
+    return true;
+}
+
+/**
+ * @brief Connect all rooms in a rectangle of a dungeon with Eller's algorithm.
+ * Only doors inside the rectangle are written, so rectangles which don't
+ * overlap may be connected concurrently
+ *
+ * @param ctx The generator to get random numbers from
+ * @param dungeon The dungeon to connect
+ * @param x0 The X coordinate of the rectangle's top left room
+ * @param y0 The Y coordinate of the rectangle's top left room
+ * @param tw The width of the rectangle, in rooms
+ * @param th The height of the rectangle, in rooms
+ * @param rowMem Memory for Eller's algorithm, at least ellersRowSize(tw) bytes
+ */
+static void connectEllersTile(genCtx_t* ctx, dungeon_t* dungeon, int x0, int y0, int tw, int th, void* rowMem)
+{
+    ellersRow_t er;
+    initEllersRow(&er, tw, th, rowMem);
+
+    // For each row of the rectangle
+    for (int y = 0; y < th; y++)
+    {
+        nextEllersRow(ctx, &er);
+
+        // Copy the row's doors into the dungeon
+        for (int x = 0; x < tw - 1; x++)
+        {
+            if (er.rightDoors[x])
+            {
+                openDoor(dungeon, roomIdx(dungeon, x0 + x, y0 + y), DOOR_RIGHT);
+            }
+        }
+        if (y < (th - 1))
         {
-            dungeon->rooms[x][y].doors[DOOR_RIGHT]    = &dungeon->doors[doorIdx];
-            dungeon->rooms[x + 1][y].doors[DOOR_LEFT] = &dungeon->doors[doorIdx];
+            for (int x = 0; x < tw; x++)
+            {
+                if (er.downDoors[x])
+                {
+                    openDoor(dungeon, roomIdx(dungeon, x0 + x, y0 + y), DOOR_DOWN);
+                }
+            }
+        }
+    }
 
-            dungeon->doors[doorIdx].rooms[0] = &dungeon->rooms[x][y];
-            dungeon->doors[doorIdx].rooms[1] = &dungeon->rooms[x + 1][y];
+    freeEllersRow(&er);
+}
 
-            doorIdx++;
+/**
+ * @brief Worker thread for connectDungeonTiled(). Takes tiles from the queue
+ * and connects them until it is empty
+ *
+ * @param arg The tileWorker_t for this thread
+ * @return NULL
+ */
+static void* tileWorker(void* arg)
+{
+    tileWorker_t* worker = arg;
+    tileQueue_t* queue   = worker->queue;
+    dungeon_t* dungeon   = queue->dungeon;
+    while (true)
+    {
+        pthread_mutex_lock(&queue->lock);
+        int tile = queue->nextTile++;
+        pthread_mutex_unlock(&queue->lock);
+
+        if (tile >= queue->numTiles)
+        {
+            return NULL;
         }
+
+        // Each tile has its own random stream, so the result doesn't depend on which thread runs it
+        genCtx_t ctx;
+        initGenCtx(&ctx, queue->seed + tile);
+
+        int x0 = (tile % queue->tilesX) * TILE_SIZE;
+        int y0 = (tile / queue->tilesX) * TILE_SIZE;
+        connectEllersTile(&ctx, dungeon, x0, y0, MIN(TILE_SIZE, dungeon->w - x0), MIN(TILE_SIZE, dungeon->h - y0),
+                          worker->rowMem);
     }
+}
 
-    // Connect up/down doors
-    for (int y = 0; y < height - 1; y++)
+/**
+ * @brief Connect all rooms in a dungeon by splitting it into tiles, connecting
+ * each tile with Eller's algorithm on ctx->numThreads threads, then stitching
+ * the tiles together. Stitching is Kruskal's algorithm on the tiles: seams
+ * between tiles are shuffled and one random door is opened in each seam which
+ * joins two groups of tiles that aren't connected yet. The result is still a
+ * perfect maze and is the same for any number of threads.
+ *
+ * @param ctx The generator to get random numbers from
+ * @param dungeon The dungeon to connect
+ * @return true if the dungeon was connected, false if there wasn't enough memory
+ */
+bool connectDungeonTiled(genCtx_t* ctx, dungeon_t* dungeon)
+{
+    tileQueue_t queue = {
+        .dungeon  = dungeon,
+        .seed     = rngNext(&ctx->rng),
+        .tilesX   = (dungeon->w + TILE_SIZE - 1) / TILE_SIZE,
+        .numTiles = 0,
+        .nextTile = 0,
+    };
+    int tilesY     = (dungeon->h + TILE_SIZE - 1) / TILE_SIZE;
+    queue.numTiles = queue.tilesX * tilesY;
+    pthread_mutex_init(&queue.lock, NULL);
+
+    // Give each worker its own memory for Eller's algorithm
+    scratchMark_t mark    = scratchMark(&dungeon->scratch);
+    int numThreads        = MIN(ctx->numThreads, queue.numTiles);
+    numThreads            = (numThreads < 1) ? 1 : numThreads;
+    tileWorker_t* workers = scratchAlloc(&dungeon->scratch, numThreads * sizeof(tileWorker_t));
+    if (NULL == workers)
+    {
+        pthread_mutex_destroy(&queue.lock);
+        return false;
+    }
+    for (int t = 0; t < numThreads; t++)
     {
-        for (int x = 0; x < width; x++)
+        workers[t].queue  = &queue;
+        workers[t].rowMem = scratchAlloc(&dungeon->scratch, ellersRowSize(TILE_SIZE));
+        if (NULL == workers[t].rowMem)
         {
-            dungeon->rooms[x][y].doors[DOOR_DOWN]   = &dungeon->doors[doorIdx];
-            dungeon->rooms[x][y + 1].doors[DOOR_UP] = &dungeon->doors[doorIdx];
+            // Make do with the workers which got memory
+            numThreads = t;
+            break;
+        }
+    }
+    if (0 == numThreads)
+    {
+        pthread_mutex_destroy(&queue.lock);
+        scratchRelease(&dungeon->scratch, mark);
+        return false;
+    }
 
-            dungeon->doors[doorIdx].rooms[0] = &dungeon->rooms[x][y];
-            dungeon->doors[doorIdx].rooms[1] = &dungeon->rooms[x][y + 1];
+    // Connect each tile on its own
+    pthread_t* threads = NULL;
+    bool* started      = NULL;
+    if (numThreads > 1)
+    {
+        threads = scratchAlloc(&dungeon->scratch, numThreads * sizeof(pthread_t));
+        started = scratchAlloc(&dungeon->scratch, numThreads * sizeof(bool));
+    }
+    if (NULL == threads || NULL == started)
+    {
+        // One worker takes every tile from the queue
+        tileWorker(&workers[0]);
+    }
+    else
+    {
+        for (int t = 0; t < numThreads; t++)
+        {
+            started[t] = (0 == pthread_create(&threads[t], NULL, tileWorker, &workers[t]));
+        }
 
-            doorIdx++;
+        // Workers which didn't start are run here instead. They take tiles from the same queue
+        for (int t = 0; t < numThreads; t++)
+        {
+            if (!started[t])
+            {
+                tileWorker(&workers[t]);
+            }
+        }
+        for (int t = 0; t < numThreads; t++)
+        {
+            if (started[t])
+            {
+                pthread_join(threads[t], NULL);
+            }
+        }
+    }
+    pthread_mutex_destroy(&queue.lock);
+
+    // List every seam between two tiles. Seam (2 * t) is right of tile t and (2 * t) + 1 is below it
+    int* seams   = scratchAlloc(&dungeon->scratch, 2 * queue.numTiles * sizeof(int));
+    int numSeams = 0;
+    if (NULL == seams)
+    {
+        scratchRelease(&dungeon->scratch, mark);
+        return false;
+    }
+    for (int tile = 0; tile < queue.numTiles; tile++)
+    {
+        if ((tile % queue.tilesX) < (queue.tilesX - 1))
+        {
+            seams[numSeams++] = 2 * tile;
+        }
+        if ((tile / queue.tilesX) < (tilesY - 1))
+        {
+            seams[numSeams++] = (2 * tile) + 1;
+        }
+    }
+    fisherYates(ctx, seams, numSeams);
+
+    // Each tile is connected inside, so join tiles with a union-find of tiles
+    int32_t* parent = scratchAlloc(&dungeon->scratch, queue.numTiles * sizeof(int32_t));
+    if (NULL == parent)
+    {
+        scratchRelease(&dungeon->scratch, mark);
+        return false;
+    }
+    memset(parent, 0xFF, queue.numTiles * sizeof(int32_t));
+    for (int i = 0; i < numSeams; i++)
+    {
+        int tile     = seams[i] / 2;
+        bool isRight = (0 == (seams[i] % 2));
+        int x0       = (tile % queue.tilesX) * TILE_SIZE;
+        int y0       = (tile / queue.tilesX) * TILE_SIZE;
+        int tw       = MIN(TILE_SIZE, dungeon->w - x0);
+        int th       = MIN(TILE_SIZE, dungeon->h - y0);
+
+        if (unionRoomSets(parent, tile, isRight ? (tile + 1) : (tile + queue.tilesX)))
+        {
+            // Open a random door along the seam
+            if (isRight)
+            {
+                int y = y0 + rngBounded(&ctx->rng, th);
+                openDoor(dungeon, roomIdx(dungeon, x0 + tw - 1, y), DOOR_RIGHT);
+            }
+            else
+            {
+                int x = x0 + rngBounded(&ctx->rng, tw);
+                openDoor(dungeon, roomIdx(dungeon, x, y0 + th - 1), DOOR_DOWN);
+            }
+        }
+    }
+
+    scratchRelease(&dungeon->scratch, mark);
+    return true;
+}
+
+/**
+ * @brief Connect all rooms in a dungeon with a recursive backtracker, which
+ * walks randomly until it hits a dead end, then backs up to the last room with
+ * an unvisited neighbour. This makes long, winding corridors and fewer dead
+ * ends than Eller's algorithm.
+ *
+ * The path back is kept on an explicit stack, allocated once, rather than in C
+ * recursion, so the depth is only limited by the number of rooms.
+ *
+ * @param ctx The generator to get random numbers from
+ * @param dungeon The dungeon to connect
+ * @return true if the dungeon was connected, false if there wasn't enough memory
+ */
+bool connectDungeonRecursive(genCtx_t* ctx, dungeon_t* dungeon)
+{
+    // The path can't be longer than the number of rooms, so pushing never needs to grow it
+    scratchMark_t mark = scratchMark(&dungeon->scratch);
+    roomStack_t path;
+    if (!initRoomStack(&path, &dungeon->scratch, dungeon->numRooms))
+    {
+        return false;
+    }
+
+    // Mark all cells as not visited
+    startVisit(dungeon);
+
+    // Start from a random room
+    int32_t start = rasterRoom(dungeon, rngNext(&ctx->rng) % dungeon->numRooms);
+    markVisited(dungeon, start);
+    pushRoom(&path, start);
+
+    while (path.len > 0)
+    {
+        int32_t thisRoom = path.rooms[path.len - 1];
+        int x            = roomX(dungeon, thisRoom);
+        int y            = roomY(dungeon, thisRoom);
+
+        // Find all unvisited neighbours
+        doorIdx options[DOOR_MAX];
+        int numOptions = 0;
+        if (y > 0 && !isVisited(dungeon, roomNeighbour(dungeon, thisRoom, DOOR_UP)))
+        {
+            options[numOptions++] = DOOR_UP;
+        }
+        if (y < (dungeon->h - 1) && !isVisited(dungeon, roomNeighbour(dungeon, thisRoom, DOOR_DOWN)))
+        {
+            options[numOptions++] = DOOR_DOWN;
+        }
+        if (x > 0 && !isVisited(dungeon, roomNeighbour(dungeon, thisRoom, DOOR_LEFT)))
+        {
+            options[numOptions++] = DOOR_LEFT;
+        }
+        if (x < (dungeon->w - 1) && !isVisited(dungeon, roomNeighbour(dungeon, thisRoom, DOOR_RIGHT)))
+        {
+            options[numOptions++] = DOOR_RIGHT;
+        }
+
+        if (0 == numOptions)
+        {
+            // Dead end, back up
+            popRoom(&path);
+        }
+        else
+        {
+            // Pick a random neighbour, open the door to it, and move there
+            doorIdx dir      = options[(1 == numOptions) ? 0 : (rngNext(&ctx->rng) % numOptions)];
+            int32_t nextRoom = roomNeighbour(dungeon, thisRoom, dir);
+
+            openDoor(dungeon, thisRoom, dir);
+            markVisited(dungeon, nextRoom);
+            pushRoom(&path, nextRoom);
+        }
+    }
+
+    scratchRelease(&dungeon->scratch, mark);
+    return true;
+}
+
+/**
+ * @brief Connect all rooms in a dungeon with Kruskal's algorithm. Every wall
+ * which could be a door is shuffled once, then walls are opened in that order
+ * if they join two rooms which aren't connected yet. This gives an unbiased
+ * maze for the cost of one shuffle and near-linear unions.
+ *
+ * @param ctx The generator to get random numbers from
+ * @param dungeon The dungeon to connect
+ * @return true if the dungeon was connected, false if there wasn't enough memory
+ */
+bool connectDungeonKruskal(genCtx_t* ctx, dungeon_t* dungeon)
+{
+    // List every wall between two rooms, left/right walls then up/down walls
+    int numWalls       = ((dungeon->w - 1) * dungeon->h) + (dungeon->w * (dungeon->h - 1));
+    scratchMark_t mark = scratchMark(&dungeon->scratch);
+    int* walls         = scratchAlloc(&dungeon->scratch, numWalls * sizeof(int));
+    int wallIdx        = 0;
+    if (NULL == walls)
+    {
+        return false;
+    }
+    for (int y = 0; y < dungeon->h; y++)
+    {
+        for (int x = 0; x < dungeon->w - 1; x++)
+        {
+            walls[wallIdx++] = roomDoor(dungeon, roomIdx(dungeon, x, y), DOOR_RIGHT);
+        }
+    }
+    for (int y = 0; y < dungeon->h - 1; y++)
+    {
+        for (int x = 0; x < dungeon->w; x++)
+        {
+            walls[wallIdx++] = roomDoor(dungeon, roomIdx(dungeon, x, y), DOOR_DOWN);
+        }
+    }
+    fisherYates(ctx, walls, numWalls);
+
+    // Each room starts in its own set. Roots store the negative size of their set
+    int32_t* parent = scratchAlloc(&dungeon->scratch, dungeon->numRooms * sizeof(int32_t));
+    if (NULL == parent)
+    {
+        scratchRelease(&dungeon->scratch, mark);
+        return false;
+    }
+    memset(parent, 0xFF, dungeon->numRooms * sizeof(int32_t));
+    int32_t numSets = dungeon->numRooms;
+
+    // Open walls until everything is connected
+    for (int i = 0; i < numWalls && numSets > 1; i++)
+    {
+        // The wall is to the right of or below a room
+        doorIdx dir   = (walls[i] < dungeon->numRooms) ? DOOR_RIGHT : DOOR_DOWN;
+        int32_t room  = (DOOR_RIGHT == dir) ? walls[i] : (walls[i] - dungeon->numRooms);
+        int32_t other = roomNeighbour(dungeon, room, dir);
+
+        if (unionRoomSets(parent, room, other))
+        {
+            numSets--;
+            openDoor(dungeon, room, dir);
+        }
+    }
+
+    scratchRelease(&dungeon->scratch, mark);
+    return true;
+}
+
+/**
+ * @brief Connect all rooms in a dungeon with Wilson's algorithm, which makes a
+ * uniform spanning tree, i.e. every possible maze is equally likely.
+ *
+ * Starting from each room not yet in the maze, take a random walk until the
+ * maze is hit, remembering only the last direction taken out of each room.
+ * Following those directions from the start of the walk gives the walk with
+ * its loops erased, which is added to the maze. Walks are slow while the maze
+ * is small and get quicker as it grows.
+ *
+ * @param ctx The generator to get random numbers from
+ * @param dungeon The dungeon to connect
+ * @return true if the dungeon was connected, false if there wasn't enough memory
+ */
+bool connectDungeonWilson(genCtx_t* ctx, dungeon_t* dungeon)
+{
+    // The last direction taken out of each room on the current walk
+    scratchMark_t mark = scratchMark(&dungeon->scratch);
+    uint8_t* exits     = scratchAlloc(&dungeon->scratch, dungeon->numRooms * sizeof(uint8_t));
+    if (NULL == exits)
+    {
+        return false;
+    }
+
+    // Nothing is in the maze except for one random room
+    startVisit(dungeon);
+    markVisited(dungeon, rasterRoom(dungeon, rngBounded(&ctx->rng, dungeon->numRooms)));
+
+    for (int32_t i = 0; i < dungeon->numRooms; i++)
+    {
+        int32_t start = rasterRoom(dungeon, i);
+        if (isVisited(dungeon, start))
+        {
+            continue;
+        }
+
+        // Walk randomly until the maze is hit
+        int32_t room = start;
+        int x        = roomX(dungeon, start);
+        int y        = roomY(dungeon, start);
+        while (!isVisited(dungeon, room))
+        {
+            // Find all neighbours
+            doorIdx options[DOOR_MAX];
+            int numOptions = 0;
+            if (y > 0)
+            {
+                options[numOptions++] = DOOR_UP;
+            }
+            if (y < (dungeon->h - 1))
+            {
+                options[numOptions++] = DOOR_DOWN;
+            }
+            if (x > 0)
+            {
+                options[numOptions++] = DOOR_LEFT;
+            }
+            if (x < (dungeon->w - 1))
+            {
+                options[numOptions++] = DOOR_RIGHT;
+            }
+
+            // Pick one and step there
+            doorIdx dir = options[rngBounded(&ctx->rng, numOptions)];
+            exits[room] = dir;
+            room        = roomNeighbour(dungeon, room, dir);
+            x += cardinals[dir].x;
+            y += cardinals[dir].y;
+        }
+
+        // Retrace the walk without its loops, adding it to the maze
+        room = start;
+        while (!isVisited(dungeon, room))
+        {
+            markVisited(dungeon, room);
+            openDoor(dungeon, room, exits[room]);
+            room = roomNeighbour(dungeon, room, exits[room]);
         }
     }
+
+    scratchRelease(&dungeon->scratch, mark);
+    return true;
+}
+
+/**
+ * @brief Find the root of a room's set in a flat union-find, halving the path
+ * to it along the way
+ *
+ * @param parent Each room's parent, or the negative size of the set for roots
+ * @param room The room to find the root of
+ * @return The root room, which is the same for all connected rooms
+ */
+static int32_t findRoomSet(int32_t* parent, int32_t room)
+{
+    while (parent[room] >= 0)
+    {
+        if (parent[parent[room]] >= 0)
+        {
+            parent[room] = parent[parent[room]];
+        }
+        room = parent[room];
+    }
+    return room;
+}
+
+/**
+ * @brief Merge the sets of two rooms, attaching the smaller set to the larger one
+ *
+ * @param parent Each room's parent, or the negative size of the set for roots
+ * @param a A room in one set
+ * @param b A room in the other set
+ * @return true if the sets were merged, false if the rooms were already in the same set
+ */
+static bool unionRoomSets(int32_t* parent, int32_t a, int32_t b)
+{
+    a = findRoomSet(parent, a);
+    b = findRoomSet(parent, b);
+    if (a == b)
+    {
+        return false;
+    }
+
+    if (parent[a] > parent[b])
+    {
+        int32_t tmp = a;
+        a           = b;
+        b           = tmp;
+    }
+    parent[a] += parent[b];
+    parent[b] = a;
+    return true;
+}
+
+/**
+ * @brief Point each of the arrays for Eller's algorithm into a block of memory
+ *
+ * @param er The state to lay out, w must be set
+ * @param mem The block of memory, or NULL to only measure how big it must be
+ * @return The size of the block of memory, in bytes
+ */
+static size_t layoutEllersRow(ellersRow_t* er, uint8_t* mem)
+{
+    size_t size = 0;
+#define CARVE(field, count)                                     \
+    er->field = (NULL != mem) ? (void*)(mem + size) : NULL;     \
+    size += ALIGN_UP((size_t)(count) * sizeof(*er->field))
+
+    CARVE(sets, er->w);
+    CARVE(relabel, (2 * er->w) + 1);
+    CARVE(parent, (2 * er->w) + 1);
+    CARVE(rank, (2 * er->w) + 1);
+    CARVE(setHasDoor, (2 * er->w) + 1);
+    CARVE(upDoors, er->w);
+    CARVE(rightDoors, er->w);
+    CARVE(downDoors, er->w);
+
+#undef CARVE
+    return size;
+}
+
+/**
+ * @brief Get the size of the memory Eller's algorithm needs
+ *
+ * @param width The width of the dungeon
+ * @return The size of the memory, in bytes
+ */
+size_t ellersRowSize(int width)
+{
+    ellersRow_t er = {.w = width};
+    return layoutEllersRow(&er, NULL);
 }
 
 /**
- * @brief TODO doc
+ * @brief Initialize state for Eller's algorithm. The first call to
+ * nextEllersRow() will generate the first row
  *
- * @param dungeon
+ * @param er The state to initialize
+ * @param width The width of the dungeon
+ * @param height The height of the dungeon
+ * @param mem Memory for the state, at least ellersRowSize(width) bytes, or
+ * NULL to allocate it
  */
-void freeDungeon(dungeon_t* dungeon)
+void initEllersRow(ellersRow_t* er, int width, int height, void* mem)
 {
-    // Free doors
-    free(dungeon->doors);
-    // Free columns
-    for (int i = 0; i < dungeon->w; i++)
+    er->w       = width;
+    er->h       = height;
+    er->y       = -1;
+    er->nextSet = 1;
+
+    size_t size = layoutEllersRow(er, NULL);
+    er->mem     = NULL;
+    if (NULL == mem)
     {
-        free(dungeon->rooms[i]);
+        mem = er->mem = malloc(size);
     }
-    // Free rows
-    free(dungeon->rooms);
+    memset(mem, 0, size);
+    layoutEllersRow(er, mem);
 }
 
 /**
- * @brief TODO doc
+ * @brief Free state for Eller's algorithm
  *
- * @param dungeon
+ * @param er The state to free
  */
-void connectDungeonEllers(dungeon_t* dungeon)
+void freeEllersRow(ellersRow_t* er)
 {
-    // Keep track of which set each room belongs to
-    int32_t setIdx = 1;
+    free(er->mem);
+}
 
-    // For each row of the dungeon
-    for (int y = 0; y < dungeon->h; y++)
+/**
+ * @brief Generate the next row of a dungeon with Eller's algorithm. After this
+ * returns, er->y is the row which was generated and er's door arrays are final
+ * for that row
+ *
+ * @param ctx The generator to get random numbers from
+ * @param er The state for Eller's algorithm
+ */
+void nextEllersRow(genCtx_t* ctx, ellersRow_t* er)
+{
+    // Move to the next row
+    er->y++;
+    if (er->y > 0)
     {
-        // First, assign sets to cells without them
-        for (int x = 0; x < dungeon->w; x++)
+        // The doors below the last row are the doors above this one
+        bool* tmp     = er->upDoors;
+        er->upDoors   = er->downDoors;
+        er->downDoors = tmp;
+
+        // Rooms connected through the doors above keep their sets, the rest need new ones. Renumber the kept sets
+        // from 1 so that labels stay below (2 * w) no matter how many rows are generated
+        memset(er->relabel, 0, ((2 * er->w) + 1) * sizeof(int32_t));
+        er->nextSet = 1;
+        for (int x = 0; x < er->w; x++)
         {
-            if (0 == dungeon->rooms[x][y].set)
+            if (!er->upDoors[x])
+            {
+                er->sets[x] = 0;
+            }
+            else
             {
-                dungeon->rooms[x][y].set = setIdx;
-                setIdx++;
+                if (0 == er->relabel[er->sets[x]])
+                {
+                    er->relabel[er->sets[x]] = er->nextSet++;
+                }
+                er->sets[x] = er->relabel[er->sets[x]];
             }
         }
+    }
+
+    // First, assign sets to cells without them
+    for (int x = 0; x < er->w; x++)
+    {
+        if (0 == er->sets[x])
+        {
+            er->sets[x] = er->nextSet;
+            er->nextSet++;
+        }
+    }
+
+    // Every label starts out as its own set in this row
+    for (int32_t set = 0; set < er->nextSet; set++)
+    {
+        er->parent[set]     = set;
+        er->rank[set]       = 0;
+        er->setHasDoor[set] = false;
+    }
 
 #ifdef DBG_PRINT
-        printf("Starting row %d\n", y);
-        printRow(y, dungeon->w, dungeon->rooms);
+    printf("Starting row %d\n", er->y);
+    printRow(er);
 #endif
 
-        // Then, randomly create LR walls
-        for (int x = 0; x < dungeon->w - 1; x++)
+    // Then, randomly create LR walls
+    for (int x = 0; x < er->w - 1; x++)
+    {
+        // 50% chance, but also make walls between cells of the same set to avoid loops
+        if ((findSet(er, er->sets[x]) == findSet(er, er->sets[x + 1])) || (rngNext(&ctx->rng) >> 63))
         {
-            // 50% chance, but also make walls between cells of the same set to avoid loops
-            if ((dungeon->rooms[x][y].set == dungeon->rooms[x + 1][y].set) || (rand() % 2))
-            {
-                dungeon->rooms[x][y].doors[DOOR_RIGHT]->isDoor = false;
+            er->rightDoors[x] = false;
 
 #ifdef DBG_PRINT
-                printf("Add LR wall\n");
-                printRow(y, dungeon->w, dungeon->rooms);
+            printf("Add LR wall\n");
+            printRow(er);
 #endif
-            }
-            else
-            {
-                // Mark this as a door
-                dungeon->rooms[x][y].doors[DOOR_RIGHT]->isDoor = true;
+        }
+        else
+        {
+            // Mark this as a door
+            er->rightDoors[x] = true;
 
-                // Merge the sets by overwriting all olds with news in this row
-                mergeSets(dungeon, x, y);
+            // Merge the sets
+            unionSets(er, er->sets[x], er->sets[x + 1]);
 
 #ifdef DBG_PRINT
-                printf("Add LR door\n");
-                printRow(y, dungeon->w, dungeon->rooms);
+            printf("Add LR door\n");
+            printRow(er);
 #endif
-            }
         }
+    }
 
-        // If this is not the last row
-        if (y < (dungeon->h - 1))
+    // If this is not the last row
+    if (er->y < (er->h - 1))
+    {
+        // Randomly create UD walls
+        for (int x = 0; x < er->w; x++)
         {
-            // Keep track of what sets are connected to ensure all are connected
-            uint16_t setsWithDoors[dungeon->w];
-            uint8_t swdIdx = 0;
-
-            // Randomly create UD walls
-            for (int x = 0; x < dungeon->w; x++)
+            if (rngNext(&ctx->rng) >> 63)
             {
-                if (rand() % 2)
-                {
-                    // If this is a door, mark both cells as part of the same set
-                    dungeon->rooms[x][y].doors[DOOR_DOWN]->isDoor = true;
-                    dungeon->rooms[x][y + 1].set                  = dungeon->rooms[x][y].set;
+                // If this is a door, the cell below will be part of the same set
+                er->downDoors[x] = true;
 
-                    // Record this set as connected
-                    setsWithDoors[swdIdx++] = dungeon->rooms[x][y].set;
+                // Record this set as connected
+                er->setHasDoor[findSet(er, er->sets[x])] = true;
 
 #ifdef DBG_PRINT
-                    printf("Add UD door\n");
-                    printRow(y, dungeon->w, dungeon->rooms);
+                printf("Add UD door\n");
+                printRow(er);
 #endif
-                }
-                else
-                {
-                    dungeon->rooms[x][y].doors[DOOR_DOWN]->isDoor = false;
+            }
+            else
+            {
+                er->downDoors[x] = false;
 
 #ifdef DBG_PRINT
-                    printf("Add UD wall\n");
-                    printRow(y, dungeon->w, dungeon->rooms);
+                printf("Add UD wall\n");
+                printRow(er);
 #endif
-                }
             }
+        }
 
-            // Do a second pass to ensure that all sets are connected somewhere
-            for (int x = 0; x < dungeon->w; x++)
+        // Do a second pass to ensure that all sets are connected somewhere
+        for (int x = 0; x < er->w; x++)
+        {
+            // If this set is not connected
+            int32_t root = findSet(er, er->sets[x]);
+            if (!er->setHasDoor[root])
             {
-                // Check if this set is connected
-                bool setHasDoor = false;
-                for (int i = 0; i < swdIdx; i++)
-                {
-                    if (setsWithDoors[i] == dungeon->rooms[x][y].set)
-                    {
-                        setHasDoor = true;
-                        break;
-                    }
-                }
-
-                // If it is not connected
-                if (!setHasDoor)
-                {
-                    // mark both cells as part of the same set
-                    dungeon->rooms[x][y].doors[DOOR_DOWN]->isDoor = true;
-                    dungeon->rooms[x][y + 1].set                  = dungeon->rooms[x][y].set;
+                // the cell below will be part of the same set
+                er->downDoors[x] = true;
 
-                    setsWithDoors[swdIdx++] = dungeon->rooms[x][y].set;
+                er->setHasDoor[root] = true;
 
 #ifdef DBG_PRINT
-                    printf("Add UD wall (mandatory)\n");
-                    printRow(y, dungeon->w, dungeon->rooms);
+                printf("Add UD wall (mandatory)\n");
+                printRow(er);
 #endif
-                }
             }
         }
-        else
+    }
+    else
+    {
+        // Final row, make sure cells are connected
+        for (int x = 0; x < er->w - 1; x++)
         {
-            // Final row, make sure cells are connected
-            for (int x = 0; x < dungeon->w - 1; x++)
+            // Merge the sets if they aren't already
+            if (unionSets(er, er->sets[x], er->sets[x + 1]))
             {
-                if (dungeon->rooms[x][y].set != dungeon->rooms[x + 1][y].set)
-                {
-                    // Merge the sets by overwriting all olds with news in this row
-                    mergeSets(dungeon, x, y);
-                    dungeon->rooms[x][y].doors[DOOR_RIGHT]->isDoor = true;
+                er->rightDoors[x] = true;
 
 #ifdef DBG_PRINT
-                    printf("Add LR wall (last row)\n");
-                    printRow(y, dungeon->w, dungeon->rooms);
+                printf("Add LR wall (last row)\n");
+                printRow(er);
 #endif
-                }
             }
         }
+
+        // Nothing below the final row
+        memset(er->downDoors, 0, er->w * sizeof(bool));
+    }
+
+    // Label each room with its set's root so the next row can carry them down
+    for (int x = 0; x < er->w; x++)
+    {
+        er->sets[x] = findSet(er, er->sets[x]);
+    }
 #ifdef DBG_PRINT
-        printf("Final\n");
-        printRow(y, dungeon->w, dungeon->rooms);
-        printf("\n\n");
+    printf("Final\n");
+    printRow(er);
+    printf("\n\n");
 #endif
+}
+
+/**
+ * @brief Find the root label of a set, compressing the path to it along the way
+ *
+ * @param er The state for Eller's algorithm
+ * @param set The label to find the root of
+ * @return The root label, which is the same for all connected rooms in this row
+ */
+static int32_t findSet(ellersRow_t* er, int32_t set)
+{
+    int32_t root = set;
+    while (er->parent[root] != root)
+    {
+        root = er->parent[root];
+    }
+    // Point everything on the path directly at the root
+    while (er->parent[set] != root)
+    {
+        int32_t next    = er->parent[set];
+        er->parent[set] = root;
+        set             = next;
     }
+    return root;
 }
 
 /**
- * @brief TODO doc
+ * @brief Merge two sets, attaching the shorter tree under the taller one
  *
- * @param dungeon
- * @param x
- * @param y
+ * @param er The state for Eller's algorithm
+ * @param a A label in one set
+ * @param b A label in the other set
+ * @return true if the sets were merged, false if they were already the same set
  */
-void mergeSets(dungeon_t* dungeon, int x, int y)
+static bool unionSets(ellersRow_t* er, int32_t a, int32_t b)
 {
-    int newSet, oldSet;
-    if (dungeon->rooms[x][y].set < dungeon->rooms[x + 1][y].set)
+    a = findSet(er, a);
+    b = findSet(er, b);
+    if (a == b)
+    {
+        return false;
+    }
+
+    if (er->rank[a] < er->rank[b])
     {
-        newSet = dungeon->rooms[x][y].set;
-        oldSet = dungeon->rooms[x + 1][y].set;
+        er->parent[a] = b;
     }
     else
     {
-        newSet = dungeon->rooms[x + 1][y].set;
-        oldSet = dungeon->rooms[x][y].set;
+        er->parent[b] = a;
+        if (er->rank[a] == er->rank[b])
+        {
+            er->rank[a]++;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Get views of the row of rooms which Eller's algorithm generated last.
+ * There are no locks, partitions, or treasure yet
+ *
+ * @param er The state for Eller's algorithm
+ * @param views [out] Views of the rooms in the row, must have space for er->w entries
+ */
+void getEllersRoomViews(const ellersRow_t* er, roomView_t* views)
+{
+    memset(views, 0, er->w * sizeof(roomView_t));
+    for (int x = 0; x < er->w; x++)
+    {
+        roomView_t* view = &views[x];
+        int numDoors     = 0;
+        if (er->y > 0 && er->upDoors[x])
+        {
+            view->doors |= (1 << DOOR_UP);
+            numDoors++;
+        }
+        if (er->downDoors[x])
+        {
+            view->doors |= (1 << DOOR_DOWN);
+            numDoors++;
+        }
+        if (x > 0 && er->rightDoors[x - 1])
+        {
+            view->doors |= (1 << DOOR_LEFT);
+            numDoors++;
+        }
+        if (x < (er->w - 1) && er->rightDoors[x])
+        {
+            view->doors |= (1 << DOOR_RIGHT);
+            numDoors++;
+        }
+        view->isDeadEnd = (1 == numDoors);
     }
+}
 
-    for (int mergeX = 0; mergeX < dungeon->w; mergeX++)
+/**
+ * @brief Get views of a row of rooms in a dungeon
+ *
+ * @param dungeon The dungeon to get rooms from
+ * @param y The row to get
+ * @param views [out] Views of the rooms in the row, must have space for dungeon->w entries
+ */
+void getRoomViews(dungeon_t* dungeon, int y, roomView_t* views)
+{
+    for (int x = 0; x < dungeon->w; x++)
     {
-        if (oldSet == dungeon->rooms[mergeX][y].set)
+        int32_t room     = roomIdx(dungeon, x, y);
+        roomView_t* view = &views[x];
+
+        const packedRoom_t* packed = &dungeon->rooms[room];
+        view->doors                = packed->doors;
+        view->isStart              = packed->isStart;
+        view->isEnd                = packed->isEnd;
+        view->isDeadEnd            = packed->isDeadEnd;
+        view->partition            = packed->partition;
+        view->treasure             = packed->treasure;
+        for (doorIdx dir = 0; dir < DOOR_MAX; dir++)
         {
-            dungeon->rooms[mergeX][y].set = newSet;
+            int32_t door     = roomDoor(dungeon, room, dir);
+            view->locks[dir] = (door >= 0) ? dungeon->lock[door] : EMPTY_ROOM;
         }
     }
 }
 
+/**
+ * @brief Get a copy of everything about a room
+ *
+ * @param dungeon The dungeon the room is in
+ * @param x The X coordinate of the room
+ * @param y The Y coordinate of the room
+ * @return A copy of the room
+ */
+room_t getRoom(dungeon_t* dungeon, int x, int y)
+{
+    int32_t idx = roomIdx(dungeon, x, y);
+    room_t room = {
+        .isStart   = dungeon->rooms[idx].isStart,
+        .isEnd     = dungeon->rooms[idx].isEnd,
+        .isDeadEnd = dungeon->rooms[idx].isDeadEnd,
+        .treasure  = dungeon->rooms[idx].treasure,
+        .partition = dungeon->rooms[idx].partition,
+    };
+    room.doors[DOOR_UP]    = (y > 0) ? roomDoor(dungeon, idx, DOOR_UP) : -1;
+    room.doors[DOOR_DOWN]  = (y < (dungeon->h - 1)) ? roomDoor(dungeon, idx, DOOR_DOWN) : -1;
+    room.doors[DOOR_LEFT]  = (x > 0) ? roomDoor(dungeon, idx, DOOR_LEFT) : -1;
+    room.doors[DOOR_RIGHT] = (x < (dungeon->w - 1)) ? roomDoor(dungeon, idx, DOOR_RIGHT) : -1;
+    return room;
+}
+
+/**
+ * @brief Get a copy of everything about a door
+ *
+ * @param dungeon The dungeon the door is in
+ * @param door The index of the door
+ * @return A copy of the door
+ */
+door_t getDoor(dungeon_t* dungeon, int32_t door)
+{
+    door_t copy = {
+        .lock = dungeon->lock[door],
+    };
+    if (door < dungeon->numRooms)
+    {
+        // A door to the right of a room
+        copy.rooms[0] = door;
+        copy.rooms[1] = roomNeighbour(dungeon, door, DOOR_RIGHT);
+        copy.isDoor   = hasDoor(dungeon, copy.rooms[0], DOOR_RIGHT);
+    }
+    else
+    {
+        // A door below a room
+        copy.rooms[0] = door - dungeon->numRooms;
+        copy.rooms[1] = roomNeighbour(dungeon, copy.rooms[0], DOOR_DOWN);
+        copy.isDoor   = hasDoor(dungeon, copy.rooms[0], DOOR_DOWN);
+    }
+    return copy;
+}
+
 /**
  * @brief TODO doc
  *
- * @param door
+ * @param lock
  * @return true
  * @return false
  */
-bool isLocked(door_t* door)
+bool isLocked(keyType_t lock)
 {
-    switch (door->lock)
+    switch (lock)
     {
         case KEY_1:
         case KEY_2:
@@ -341,84 +1345,81 @@ bool isLocked(door_t* door)
  */
 void clearDungeonDistances(dungeon_t* dungeon)
 {
-    for (int x = 0; x < dungeon->w; x++)
-    {
-        for (int y = 0; y < dungeon->h; y++)
-        {
-            dungeon->rooms[x][y].dist = 0;
-        }
-    }
+    memset(dungeon->dist, 0, dungeon->numRooms * sizeof(*dungeon->dist));
 }
 
 /**
- * @brief TODO doc
+ * @brief Add each room's shortest distance from a starting room to its dist.
+ * Rooms are visited breadth first from a queue in scratch memory with space
+ * for every room
  *
- * @param dungeon
- * @param startX
- * @param startY
- * @param ignoreLocks
- * @return coord_t
+ * @param dungeon The dungeon to measure
+ * @param startX The X coordinate of the starting room
+ * @param startY The Y coordinate of the starting room
+ * @param ignoreLocks true to walk through locked doors, false to stop at them
+ * @param furthest Set to the coordinates of the first room found furthest from the start, may be NULL
+ * @return true if the distances were added, false if there wasn't enough memory
  */
-coord_t addDistFromRoom(dungeon_t* dungeon, uint16_t startX, uint16_t startY, bool ignoreLocks)
+bool addDistFromRoom(dungeon_t* dungeon, int startX, int startY, bool ignoreLocks, coord_t* furthest)
 {
     // Mark all cells as not visited
-    for (int x = 0; x < dungeon->w; x++)
+    startVisit(dungeon);
+
+    // Each room is queued at most once, so the queue never grows
+    scratchMark_t mark = scratchMark(&dungeon->scratch);
+    roomQueue_t queue;
+    if (!initRoomQueue(&queue, &dungeon->scratch, dungeon->numRooms))
     {
-        for (int y = 0; y < dungeon->h; y++)
-        {
-            dungeon->rooms[x][y].visited = false;
-        }
+        return false;
     }
-    // Except for the starting room
-    dungeon->rooms[startX][startY].visited = true;
 
-    // Initialize a stack of unvisited rooms
-    list_t unvisitedRooms = {0};
-    push(&unvisitedRooms, COORDS_TO_LIST(startX, startY));
+    // Start with the starting room
+    int32_t start = roomIdx(dungeon, startX, startY);
+    markVisited(dungeon, start);
+    enqueueRoom(&queue, start);
 
     // Keep track of the longest distance to the furthest room
-    int16_t longestDist  = 0;
-    coord_t furthestRoom = {0};
+    int32_t longestDist  = 0;
+    int32_t furthestRoom = start;
 
     // For the entire dungeon
-    while (unvisitedRooms.length > 0)
+    while (queue.len > 0)
     {
-        void* poppedVal  = pop(&unvisitedRooms);
-        int cX           = LIST_TO_X(poppedVal);
-        int cY           = LIST_TO_Y(poppedVal);
-        room_t* thisRoom = &(dungeon->rooms[cX][cY]);
+        int32_t thisRoom = dequeueRoom(&queue);
 
         // Check all directions
         for (doorIdx dir = 0; dir < DOOR_MAX; ++dir)
         {
             // If this is an unlocked door
-            if (thisRoom->doors[dir] && thisRoom->doors[dir]->isDoor
-                && (ignoreLocks || !isLocked(thisRoom->doors[dir])))
+            int32_t door = roomDoor(dungeon, thisRoom, dir);
+            if (hasDoor(dungeon, thisRoom, dir) && (ignoreLocks || !isLocked(dungeon->lock[door])))
             {
-                uint16_t nextX   = cX + cardinals[dir].x;
-                uint16_t nextY   = cY + cardinals[dir].y;
-                room_t* nextRoom = &(dungeon->rooms[nextX][nextY]);
+                int32_t nextRoom = roomNeighbour(dungeon, thisRoom, dir);
                 // If this room hasn't been visited yet
-                if (false == nextRoom->visited)
+                if (!isVisited(dungeon, nextRoom))
                 {
-                    // Increment the distance, push it on the stack
-                    nextRoom->dist += (thisRoom->dist + 1);
-                    nextRoom->visited = true;
-                    push(&unvisitedRooms, COORDS_TO_LIST(nextX, nextY));
+                    // Increment the distance, queue it
+                    dungeon->dist[nextRoom] += (dungeon->dist[thisRoom] + 1);
+                    markVisited(dungeon, nextRoom);
+                    enqueueRoom(&queue, nextRoom);
 
-                    if (nextRoom->dist > longestDist)
+                    if (dungeon->dist[nextRoom] > longestDist)
                     {
-                        longestDist    = nextRoom->dist;
-                        furthestRoom.x = nextX;
-                        furthestRoom.y = nextY;
+                        longestDist  = dungeon->dist[nextRoom];
+                        furthestRoom = nextRoom;
                     }
                 }
             }
         }
     }
-    clear(&unvisitedRooms);
+    scratchRelease(&dungeon->scratch, mark);
 
-    return furthestRoom;
+    if (NULL != furthest)
+    {
+        furthest->x = roomX(dungeon, furthestRoom);
+        furthest->y = roomY(dungeon, furthestRoom);
+    }
+    return true;
 }
 
 /**
@@ -427,220 +1428,417 @@ coord_t addDistFromRoom(dungeon_t* dungeon, uint16_t startX, uint16_t startY, bo
  * @param dungeon
  * @param startX
  * @param startY
- * @return int
+ * @return true if the rooms were counted, false if there wasn't enough memory
  */
-void countRoomsAfterDoors(dungeon_t* dungeon, uint16_t startX, uint16_t startY)
+bool countRoomsAfterDoors(dungeon_t* dungeon, int startX, int startY)
 {
     // Mark all cells as not visited
-    for (int x = 0; x < dungeon->w; x++)
-    {
-        for (int y = 0; y < dungeon->h; y++)
-        {
-            dungeon->rooms[x][y].visited     = false;
-            dungeon->rooms[x][y].numChildren = 0;
-        }
-    }
-    for (int d = 0; d < dungeon->numDoors; d++)
-    {
-        dungeon->doors[d].numChildren = 0;
-    }
+    startVisit(dungeon);
+    memset(dungeon->numChildren, 0, dungeon->numRooms * sizeof(*dungeon->numChildren));
+    memset(dungeon->doorNumChildren, 0, dungeon->numDoors * sizeof(*dungeon->doorNumChildren));
 
     // Build a list of rooms to visit, reverse-depth-first order
-    list_t rDepthFirstOrder = {0};
-    list_t roomStack        = {0};
-    push(&roomStack, &(dungeon->rooms[startX][startY]));
-    while (0 != roomStack.length)
+    scratchMark_t mark = scratchMark(&dungeon->scratch);
+    roomStack_t rDepthFirstOrder;
+    roomStack_t roomStack;
+    if (!initRoomStack(&rDepthFirstOrder, &dungeon->scratch, dungeon->numRooms)
+        || !initRoomStack(&roomStack, &dungeon->scratch, dungeon->numRooms))
     {
-        room_t* thisRoom = pop(&roomStack);
-        push(&rDepthFirstOrder, thisRoom);
+        scratchRelease(&dungeon->scratch, mark);
+        return false;
+    }
+    pushRoom(&roomStack, roomIdx(dungeon, startX, startY));
+    while (0 != roomStack.len)
+    {
+        int32_t thisRoom = popRoom(&roomStack);
+        if (!pushRoom(&rDepthFirstOrder, thisRoom))
+        {
+            scratchRelease(&dungeon->scratch, mark);
+            return false;
+        }
 
         // Mark this room as visited
-        thisRoom->visited = true;
+        markVisited(dungeon, thisRoom);
 
         // Check all directions
         for (doorIdx dir = 0; dir < DOOR_MAX; dir++)
         {
-            door_t* door = thisRoom->doors[dir];
+            int32_t door = roomDoor(dungeon, thisRoom, dir);
             // If this is an unlocked door
-            if (door && door->isDoor && !isLocked(door))
+            if (hasDoor(dungeon, thisRoom, dir) && !isLocked(dungeon->lock[door]))
             {
                 // Get the next room through the door
-                room_t* nextRoom = door->rooms[0] == thisRoom ? door->rooms[1] : door->rooms[0];
+                int32_t nextRoom = roomNeighbour(dungeon, thisRoom, dir);
                 // If the next room hasn't been visited yet, push it onto the stack
-                if (!nextRoom->visited)
+                if (!isVisited(dungeon, nextRoom) && !pushRoom(&roomStack, nextRoom))
                 {
-                    push(&roomStack, nextRoom);
+                    scratchRelease(&dungeon->scratch, mark);
+                    return false;
                 }
             }
         }
     }
 
     // Mark all cells as not visited, again
-    for (int x = 0; x < dungeon->w; x++)
-    {
-        for (int y = 0; y < dungeon->h; y++)
-        {
-            dungeon->rooms[x][y].visited = false;
-        }
-    }
+    startVisit(dungeon);
 
     // Visit all rooms, reverse depth first order
-    while (rDepthFirstOrder.length > 0)
+    while (rDepthFirstOrder.len > 0)
     {
-        room_t* thisRoom  = pop(&rDepthFirstOrder);
-        thisRoom->visited = true;
+        int32_t thisRoom = popRoom(&rDepthFirstOrder);
+        markVisited(dungeon, thisRoom);
 
         // Check all directions
         for (doorIdx dir = 0; dir < DOOR_MAX; dir++)
         {
-            door_t* door = thisRoom->doors[dir];
+            int32_t door = roomDoor(dungeon, thisRoom, dir);
             // If this is an unlocked door
-            if (door && door->isDoor && !isLocked(door))
+            if (hasDoor(dungeon, thisRoom, dir) && !isLocked(dungeon->lock[door]))
             {
                 // Get the other room
-                room_t* nextRoom = door->rooms[0] == thisRoom ? door->rooms[1] : door->rooms[0];
+                int32_t nextRoom = roomNeighbour(dungeon, thisRoom, dir);
                 // If it's been visited already (i.e. working backwards)
-                if (nextRoom->visited)
+                if (isVisited(dungeon, nextRoom))
                 {
                     // Add up the number of children
-                    door->numChildren += (1 + nextRoom->numChildren);
-                    thisRoom->numChildren += (1 + nextRoom->numChildren);
+                    dungeon->doorNumChildren[door] += (1 + dungeon->numChildren[nextRoom]);
+                    dungeon->numChildren[thisRoom] += (1 + dungeon->numChildren[nextRoom]);
                 }
             }
         }
     }
+
+    scratchRelease(&dungeon->scratch, mark);
+    return true;
 }
 
 /**
- * @brief TODO doc
+ * @brief Set the partition of every room reachable from a room without
+ * passing through a locked door
  *
- * @param dungeon
- * @param startingRoom
- * @param partition
+ * @param dungeon The dungeon to partition
+ * @param startingRoom The coordinates of the room to start from
+ * @param partition The partition to set
+ * @return true if the partition was set, false if there wasn't enough memory
+ */
+bool setPartitions(dungeon_t* dungeon, coord_t startingRoom, keyType_t partition)
+{
+    return fillPartition(dungeon, roomIdx(dungeon, startingRoom.x, startingRoom.y), partition);
+}
+
+/**
+ * @brief Set the partition of every room reachable from a room without
+ * passing through a locked door. This is a scanline fill: each room taken
+ * from the stack is grown into the whole run of rooms joined to it left and
+ * right, found a word at a time from the bitboards. The doors up and down
+ * from the run are also found a word at a time
+ *
+ * @param dungeon The dungeon to partition
+ * @param startingRoom The index of the room to start from
+ * @param partition The partition to set
+ * @return true if the partition was set, false if there wasn't enough memory
  */
-void setPartitions(dungeon_t* dungeon, room_t* startingRoom, keyType_t partition)
+static bool fillPartition(dungeon_t* dungeon, int32_t startingRoom, keyType_t partition)
 {
     // Mark all cells as not visited
-    for (int x = 0; x < dungeon->w; x++)
+    startVisit(dungeon);
+
+    scratchMark_t mark = scratchMark(&dungeon->scratch);
+    roomStack_t roomStack;
+    if (!initRoomStack(&roomStack, &dungeon->scratch, dungeon->numRooms))
+    {
+        return false;
+    }
+    pushRoom(&roomStack, startingRoom);
+
+    while (0 != roomStack.len)
     {
-        for (int y = 0; y < dungeon->h; y++)
+        int32_t thisRoom = popRoom(&roomStack);
+        if (isVisited(dungeon, thisRoom))
+        {
+            continue;
+        }
+
+        // Grow the room into its run
+        int y                = roomY(dungeon, thisRoom);
+        const uint64_t* door = boardRow(dungeon, dungeon->rightBoard, y);
+        const uint64_t* lock = boardRow(dungeon, dungeon->rightLockBoard, y);
+        int start            = spanStart(door, lock, roomX(dungeon, thisRoom));
+        int end              = spanEnd(door, lock, roomX(dungeon, thisRoom));
+
+        // Mark the run's partition
+        for (int x = start; x <= end; x++)
+        {
+            int32_t room                   = roomIdx(dungeon, x, y);
+            dungeon->rooms[room].partition = partition;
+            markVisited(dungeon, room);
+        }
+
+        // Push the rooms through unlocked doors above and below the run
+        const uint64_t* upDoor   = boardRow(dungeon, dungeon->downBoard, y - 1);
+        const uint64_t* upLock   = boardRow(dungeon, dungeon->downLockBoard, y - 1);
+        const uint64_t* downDoor = boardRow(dungeon, dungeon->downBoard, y);
+        const uint64_t* downLock = boardRow(dungeon, dungeon->downLockBoard, y);
+        for (int k = start >> 6; k <= (end >> 6); k++)
         {
-            dungeon->rooms[x][y].visited = false;
+            uint64_t run = spanMask(start, end, k);
+            for (uint64_t bits = run & upDoor[k] & ~upLock[k]; 0 != bits; bits &= (bits - 1))
+            {
+                int32_t nextRoom = roomIdx(dungeon, (k << 6) + lowestBit(bits), y - 1);
+                if (!isVisited(dungeon, nextRoom) && !pushRoom(&roomStack, nextRoom))
+                {
+                    scratchRelease(&dungeon->scratch, mark);
+                    return false;
+                }
+            }
+            for (uint64_t bits = run & downDoor[k] & ~downLock[k]; 0 != bits; bits &= (bits - 1))
+            {
+                int32_t nextRoom = roomIdx(dungeon, (k << 6) + lowestBit(bits), y + 1);
+                if (!isVisited(dungeon, nextRoom) && !pushRoom(&roomStack, nextRoom))
+                {
+                    scratchRelease(&dungeon->scratch, mark);
+                    return false;
+                }
+            }
         }
     }
 
-    list_t roomStack = {0};
-    push(&roomStack, startingRoom);
+    scratchRelease(&dungeon->scratch, mark);
+    return true;
+}
 
-    while (0 != roomStack.length)
+/**
+ * @brief Lock doors to split the dungeon into numKeys + 1 partitions of about
+ * the same size. The door whose far side is closest to the next partition's
+ * size is locked, and everything behind it is that lock's partition.
+ *
+ * The rooms reachable from the start form a tree, so it is walked once to find
+ * the size behind each door. Locking a door only cuts off a subtree, so after
+ * each lock the sizes are fixed up by walking from the lock to the start
+ * rather than recounting the whole dungeon.
+ *
+ * @param dungeon The dungeon to lock doors in
+ * @param goals The keys, in the order they must be collected
+ * @param numKeys The number of keys
+ * @param startRoom The room the player starts in
+ * @return true if the locks were placed, false if there wasn't enough memory
+ */
+bool placeLocks(dungeon_t* dungeon, const keyType_t* goals, int numKeys, coord_t startRoom)
+{
+    int32_t start = roomIdx(dungeon, startRoom.x, startRoom.y);
+
+    // Rooms in the order they were walked, so each subtree is a contiguous range
+    scratchMark_t mark = scratchMark(&dungeon->scratch);
+    int32_t* order     = scratchAlloc(&dungeon->scratch, dungeon->numRooms * sizeof(int32_t));
+    // Each room's position in order
+    int32_t* orderIdx = scratchAlloc(&dungeon->scratch, dungeon->numRooms * sizeof(int32_t));
+    // Each room's parent, and the door to it, -1 for the start
+    int32_t* parentRoom = scratchAlloc(&dungeon->scratch, dungeon->numRooms * sizeof(int32_t));
+    int32_t* parentDoor = scratchAlloc(&dungeon->scratch, dungeon->numRooms * sizeof(int32_t));
+    // The number of rooms under each room when the tree was walked
+    int32_t* subtreeSize = scratchAlloc(&dungeon->scratch, dungeon->numRooms * sizeof(int32_t));
+    // true for the root of each subtree which has been locked off
+    bool* isCut = scratchAlloc(&dungeon->scratch, dungeon->numRooms * sizeof(bool));
+    if (NULL == order || NULL == orderIdx || NULL == parentRoom || NULL == parentDoor || NULL == subtreeSize
+        || NULL == isCut)
     {
-        room_t* thisRoom = pop(&roomStack);
-
-        // Mark this room's partition
-        thisRoom->partition = partition;
-        thisRoom->visited   = true;
+        scratchRelease(&dungeon->scratch, mark);
+        return false;
+    }
+    memset(isCut, false, dungeon->numRooms * sizeof(bool));
+
+    // Nothing is counted outside of the tree
+    memset(dungeon->numChildren, 0, dungeon->numRooms * sizeof(*dungeon->numChildren));
+    memset(dungeon->doorNumChildren, 0, dungeon->numDoors * sizeof(*dungeon->doorNumChildren));
+
+    // Walk the tree depth first. order doubles as the stack, entries past numOrdered haven't been walked yet
+    startVisit(dungeon);
+    int32_t numOrdered = 0;
+    int32_t top        = dungeon->numRooms;
+    order[--top]       = start;
+    parentRoom[start]  = -1;
+    parentDoor[start]  = -1;
+    markVisited(dungeon, start);
+    while (top < dungeon->numRooms)
+    {
+        int32_t thisRoom    = order[top++];
+        orderIdx[thisRoom]  = numOrdered;
+        order[numOrdered++] = thisRoom;
 
         // Check all directions
         for (doorIdx dir = 0; dir < DOOR_MAX; dir++)
         {
-            door_t* door = thisRoom->doors[dir];
+            int32_t door = roomDoor(dungeon, thisRoom, dir);
             // If this is an unlocked door
-            if (door && door->isDoor && !isLocked(door))
+            if (hasDoor(dungeon, thisRoom, dir) && !isLocked(dungeon->lock[door]))
             {
                 // Get the next room through the door
-                room_t* nextRoom = door->rooms[0] == thisRoom ? door->rooms[1] : door->rooms[0];
+                int32_t nextRoom = roomNeighbour(dungeon, thisRoom, dir);
                 // If the next room hasn't been visited yet, push it onto the stack
-                if (!nextRoom->visited)
+                if (!isVisited(dungeon, nextRoom))
                 {
-                    push(&roomStack, nextRoom);
+                    markVisited(dungeon, nextRoom);
+                    parentRoom[nextRoom] = thisRoom;
+                    parentDoor[nextRoom] = door;
+                    order[--top]         = nextRoom;
                 }
             }
         }
     }
-}
 
-/**
- * @brief TODO
- *
- * @param dungeon
- * @param goals
- * @param numKeys
- * @param startRoom
- */
-void placeLocks(dungeon_t* dungeon, const keyType_t* goals, int numKeys, coord_t startRoom)
-{
+    // Add up subtree sizes, children before parents
+    for (int32_t i = numOrdered - 1; i >= 0; i--)
+    {
+        int32_t room      = order[i];
+        subtreeSize[room] = dungeon->numChildren[room];
+        if (parentRoom[room] >= 0)
+        {
+            dungeon->doorNumChildren[parentDoor[room]] = 1 + dungeon->numChildren[room];
+            dungeon->numChildren[parentRoom[room]] += (1 + dungeon->numChildren[room]);
+        }
+    }
+
     // Place locks by partitioning the dungeon into roughly equal size chunks
     for (uint8_t i = 0; i < numKeys; i++)
     {
-        // Figure out how many rooms are behind each door
-        countRoomsAfterDoors(dungeon, startRoom.x, startRoom.y);
+        keyType_t goal = goals[numKeys - i - 1];
 
         // Each partition in the dungeon should be about this size
-        int tpSize = (dungeon->rooms[startRoom.x][startRoom.y].numChildren + 1) / (numKeys + 1 - i);
+        int tpSize = (dungeon->numChildren[start] + 1) / (numKeys + 1 - i);
 
-        // Find the door that best partitions the dungeon
+        // Find the door that best partitions the dungeon. Check left/right doors, then up/down doors. Slots are
+        // scanned in memory order, and ties go to the first door in row-major order so every layout picks the same
         int bestPartitionDiff = dungeon->w * dungeon->h + 1;
-        door_t* bestDoor      = NULL;
-        for (int d = 0; d < dungeon->numDoors; d++)
+        int32_t bestDoor      = -1;
+        int32_t bestOrder     = 0;
+        for (int32_t door = 0; door < dungeon->numDoors; door++)
         {
-            door_t* door = &(dungeon->doors[d]);
             // Try to get this as close to zero as we can
-            int partitionDiff = ABS(tpSize - door->numChildren);
-            if (partitionDiff < bestPartitionDiff)
+            int partitionDiff = ABS(tpSize - dungeon->doorNumChildren[door]);
+            if (partitionDiff > bestPartitionDiff)
+            {
+                continue;
+            }
+
+            bool isDown   = (door >= dungeon->numRooms);
+            int32_t room  = isDown ? (door - dungeon->numRooms) : door;
+            int32_t order = (isDown ? dungeon->numRooms : 0) + rasterOrder(dungeon, room);
+            if (partitionDiff == bestPartitionDiff && order > bestOrder)
+            {
+                continue;
+            }
+
+            // Skip the slots past the right and bottom edges, which aren't doors
+            if (isDown ? (roomY(dungeon, room) == dungeon->h - 1) : (roomX(dungeon, room) == dungeon->w - 1))
             {
-                bestPartitionDiff = partitionDiff;
-                bestDoor          = door;
+                continue;
             }
+
+            bestPartitionDiff = partitionDiff;
+            bestDoor          = door;
+            bestOrder         = order;
         }
 
         // Lock the door
-        bestDoor->lock = goals[numKeys - i - 1];
+        dungeon->lock[bestDoor] = goal;
+        if (isLocked(goal))
+        {
+            setDoorBit(dungeon, dungeon->rightLockBoard, dungeon->downLockBoard, bestDoor);
+        }
 
-        // Find the room after the lock
-        room_t* roomAfterLock;
-        if (bestDoor->rooms[0]->numChildren < bestDoor->numChildren)
+        // If the door isn't in the tree, it's a wall or it's behind another lock. Nothing reachable is cut off, so
+        // just flood the partition from the far side of the door
+        door_t door     = getDoor(dungeon, bestDoor);
+        int32_t cutSize = dungeon->doorNumChildren[bestDoor];
+        if (0 == cutSize)
         {
-            roomAfterLock = bestDoor->rooms[0];
+            if (!fillPartition(dungeon, door.rooms[1], goal))
+            {
+                scratchRelease(&dungeon->scratch, mark);
+                return false;
+            }
+            continue;
         }
-        else
+
+        // Find the room after the lock, the one further from the start
+        int32_t roomAfterLock = (parentDoor[door.rooms[0]] == bestDoor) ? door.rooms[0] : door.rooms[1];
+
+        // If the goal doesn't actually lock doors, nothing is cut off either
+        if (!isLocked(goal))
+        {
+            if (!fillPartition(dungeon, roomAfterLock, goal))
+            {
+                scratchRelease(&dungeon->scratch, mark);
+                return false;
+            }
+            continue;
+        }
+
+        // Everything above the lock has that many fewer rooms behind it
+        for (int32_t room = parentRoom[roomAfterLock]; room >= 0; room = parentRoom[room])
         {
-            roomAfterLock = bestDoor->rooms[1];
+            dungeon->numChildren[room] -= cutSize;
+            if (parentDoor[room] >= 0)
+            {
+                dungeon->doorNumChildren[parentDoor[room]] -= cutSize;
+            }
         }
 
-        // Mark the partition of all rooms after the lock
-        setPartitions(dungeon, roomAfterLock, goals[numKeys - i - 1]);
+        // Mark the partition of all rooms after the lock, and take them out of the tree. Skip over subtrees which
+        // were already locked off
+        int32_t end = orderIdx[roomAfterLock] + subtreeSize[roomAfterLock] + 1;
+        for (int32_t o = orderIdx[roomAfterLock]; o < end; o++)
+        {
+            int32_t room = order[o];
+            if (isCut[room])
+            {
+                o += subtreeSize[room];
+                continue;
+            }
+            dungeon->rooms[room].partition             = goal;
+            dungeon->numChildren[room]                 = 0;
+            dungeon->doorNumChildren[parentDoor[room]] = 0;
+        }
+        isCut[roomAfterLock] = true;
     }
+
+    scratchRelease(&dungeon->scratch, mark);
+    return true;
 }
 
 /**
- * @brief TODO
+ * @brief Place each key in a random room of the partition before its lock,
+ * preferring dead ends. The shuffled list of rooms is kept in scratch memory
  *
- * @param dungeon
- * @param keys
- * @param numKeys
+ * @param ctx The generator to get random numbers from
+ * @param dungeon The dungeon to place keys in
+ * @param keys The keys to place, at most MAX_KEYS
+ * @param numKeys The number of keys to place
+ * @return true if the keys were placed, false if there wasn't enough memory
  */
-void placeKeys(dungeon_t* dungeon, const keyType_t* keys, int numKeys)
+bool placeKeys(genCtx_t* ctx, dungeon_t* dungeon, const keyType_t* keys, int numKeys)
 {
-    int allRooms[dungeon->w * dungeon->h];
+    scratchMark_t mark = scratchMark(&dungeon->scratch);
+    int* allRooms      = scratchAlloc(&dungeon->scratch, dungeon->numRooms * sizeof(int));
+    if (NULL == allRooms)
+    {
+        return false;
+    }
     for (int i = 0; i < dungeon->w * dungeon->h; i++)
     {
-        allRooms[i] = i;
+        allRooms[i] = rasterRoom(dungeon, i);
     }
-    fisherYates(allRooms, dungeon->w * dungeon->h);
+    fisherYates(ctx, allRooms, dungeon->w * dungeon->h);
 
-    bool keysPlaced[numKeys];
-    memset(keysPlaced, 0, sizeof(keysPlaced));
+    bool keysPlaced[MAX_KEYS] = {false};
 
     // Place keys in dead-ends
     for (int i = 0; i < dungeon->w * dungeon->h; i++)
     {
-        int x = allRooms[i] % dungeon->w;
-        int y = allRooms[i] / dungeon->w;
-
-        room_t* room = &(dungeon->rooms[x][y]);
+        int32_t room = allRooms[i];
 
         // Don't place items in start or end
-        if (room->isStart || room->isEnd)
+        if (dungeon->rooms[room].isStart || dungeon->rooms[room].isEnd)
         {
             continue;
         }
@@ -649,24 +1847,24 @@ void placeKeys(dungeon_t* dungeon, const keyType_t* keys, int numKeys)
         {
             if (false == keysPlaced[kIdx])
             {
-                if (room->isDeadEnd)
+                if (dungeon->rooms[room].isDeadEnd)
                 {
                     bool placeHere = false;
                     if (0 == kIdx)
                     {
-                        if (0 == room->partition)
+                        if (0 == dungeon->rooms[room].partition)
                         {
                             placeHere = true;
                         }
                     }
-                    else if (room->partition == keys[kIdx - 1])
+                    else if (dungeon->rooms[room].partition == keys[kIdx - 1])
                     {
                         placeHere = true;
                     }
 
                     if (placeHere)
                     {
-                        room->treasure   = keys[kIdx];
+                        dungeon->rooms[room].treasure = keys[kIdx];
                         keysPlaced[kIdx] = true;
                         break;
                     }
@@ -678,13 +1876,10 @@ void placeKeys(dungeon_t* dungeon, const keyType_t* keys, int numKeys)
     // Place keys in non-dead-ends
     for (int i = 0; i < dungeon->w * dungeon->h; i++)
     {
-        int x = allRooms[i] % dungeon->w;
-        int y = allRooms[i] / dungeon->w;
-
-        room_t* room = &(dungeon->rooms[x][y]);
+        int32_t room = allRooms[i];
 
         // Don't place items in start or end
-        if (room->isStart || room->isEnd)
+        if (dungeon->rooms[room].isStart || dungeon->rooms[room].isEnd)
         {
             continue;
         }
@@ -696,41 +1891,44 @@ void placeKeys(dungeon_t* dungeon, const keyType_t* keys, int numKeys)
                 bool placeHere = false;
                 if (0 == kIdx)
                 {
-                    if (0 == room->partition)
+                    if (0 == dungeon->rooms[room].partition)
                     {
                         placeHere = true;
                     }
                 }
-                else if (room->partition == keys[kIdx - 1])
+                else if (dungeon->rooms[room].partition == keys[kIdx - 1])
                 {
                     placeHere = true;
                 }
 
                 if (placeHere)
                 {
-                    room->treasure   = keys[kIdx];
+                    dungeon->rooms[room].treasure = keys[kIdx];
                     keysPlaced[kIdx] = true;
                     break;
                 }
             }
         }
     }
+    scratchRelease(&dungeon->scratch, mark);
+    return true;
 }
 
 /**
  * @brief TODO doc
  *
+ * @param ctx
  * @param arr
  * @param len
  */
-void fisherYates(int* arr, int len)
+void fisherYates(genCtx_t* ctx, int* arr, int len)
 {
     // Start from the last element and swap one by one. We don't
     // need to run for the first element that's why i > 0
     for (int i = len - 1; i > 0; i--)
     {
         // Pick a random index from 0 to i
-        int j = rand() % (i + 1);
+        int j = rngNext(&ctx->rng) % (i + 1);
 
         // Swap arr[i] with the element at random index
         int tmp = arr[i];
@@ -740,30 +1938,40 @@ void fisherYates(int* arr, int len)
 }
 
 /**
- * @brief TODO doc
+ * @brief Mark every room with exactly one door as a dead end. The doors are
+ * counted 64 rooms at a time from the bitboards, and only the dead ends
+ * themselves are touched
  *
- * @param dungeon
+ * @param dungeon The dungeon to mark
+ * @return true if the dead ends were marked, false if there wasn't enough memory
  */
-void markDeadEnds(dungeon_t* dungeon)
+bool markDeadEnds(dungeon_t* dungeon)
 {
+    scratchMark_t mark = scratchMark(&dungeon->scratch);
+    int numWords       = dungeon->boardStride - 1;
+    uint64_t* deadEnds = scratchAlloc(&dungeon->scratch, numWords * sizeof(uint64_t));
+    if (NULL == deadEnds)
+    {
+        return false;
+    }
+
     for (int y = 0; y < dungeon->h; y++)
     {
-        for (int x = 0; x < dungeon->w; x++)
+        deadEndWords(boardRow(dungeon, dungeon->rightBoard, y), boardRow(dungeon, dungeon->downBoard, y),
+                     boardRow(dungeon, dungeon->downBoard, y - 1), deadEnds, numWords);
+
+        // Mark each set bit's room
+        for (int k = 0; k < numWords; k++)
         {
-            int numDoors = 0;
-            numDoors += (dungeon->rooms[x][y].doors[DOOR_UP] && dungeon->rooms[x][y].doors[DOOR_UP]->isDoor) ? 1 : 0;
-            numDoors
-                += (dungeon->rooms[x][y].doors[DOOR_DOWN] && dungeon->rooms[x][y].doors[DOOR_DOWN]->isDoor) ? 1 : 0;
-            numDoors
-                += (dungeon->rooms[x][y].doors[DOOR_LEFT] && dungeon->rooms[x][y].doors[DOOR_LEFT]->isDoor) ? 1 : 0;
-            numDoors
-                += (dungeon->rooms[x][y].doors[DOOR_RIGHT] && dungeon->rooms[x][y].doors[DOOR_RIGHT]->isDoor) ? 1 : 0;
-            if (1 == numDoors)
+            for (uint64_t bits = deadEnds[k]; 0 != bits; bits &= (bits - 1))
             {
-                dungeon->rooms[x][y].isDeadEnd = true;
+                dungeon->rooms[roomIdx(dungeon, (k << 6) + lowestBit(bits), y)].isDeadEnd = true;
             }
         }
     }
+
+    scratchRelease(&dungeon->scratch, mark);
+    return true;
 }
 
 /**
@@ -772,11 +1980,15 @@ void markDeadEnds(dungeon_t* dungeon)
  * @param dungeon
  * @param startRoom
  * @param finalPartition
+ * @return true if the end was marked, false if there wasn't enough memory
  */
-void markEnd(dungeon_t* dungeon, coord_t startRoom, keyType_t finalPartition)
+bool markEnd(dungeon_t* dungeon, coord_t startRoom, keyType_t finalPartition)
 {
     clearDungeonDistances(dungeon);
-    addDistFromRoom(dungeon, startRoom.x, startRoom.y, true);
+    if (!addDistFromRoom(dungeon, startRoom.x, startRoom.y, true, NULL))
+    {
+        return false;
+    }
     int greatestDist = 0;
     coord_t end      = {
         .x = 0,
@@ -786,34 +1998,34 @@ void markEnd(dungeon_t* dungeon, coord_t startRoom, keyType_t finalPartition)
     {
         for (int x = 0; x < dungeon->w; x++)
         {
-            if (dungeon->rooms[x][y].partition == finalPartition)
+            int32_t room = roomIdx(dungeon, x, y);
+            if (dungeon->rooms[room].partition == finalPartition)
             {
-                if (dungeon->rooms[x][y].dist > greatestDist)
+                if (dungeon->dist[room] > greatestDist)
                 {
-                    greatestDist = dungeon->rooms[x][y].dist;
+                    greatestDist = dungeon->dist[room];
                     end.x        = x;
                     end.y        = y;
                 }
             }
         }
     }
-    dungeon->rooms[end.x][end.y].isEnd = true;
+    dungeon->rooms[roomIdx(dungeon, end.x, end.y)].isEnd = true;
+    return true;
 }
 
 #ifdef DBG_PRINT
 /**
- * @brief TODO doc
+ * @brief Print the current row of Eller's algorithm
  *
- * @param y
- * @param width
- * @param rooms
+ * @param er The state for Eller's algorithm
  */
-void printRow(int y, int width, room_t** rooms)
+void printRow(const ellersRow_t* er)
 {
-    for (int x = 0; x < width; x++)
+    for (int x = 0; x < er->w; x++)
     {
-        printf("%2d", rooms[x][y].set);
-        if (rooms[x][y].doors[DOOR_RIGHT] && !rooms[x][y].doors[DOOR_RIGHT]->isDoor)
+        printf("%2d", er->sets[x]);
+        if (x < (er->w - 1) && !er->rightDoors[x])
         {
             printf("|");
         }
@@ -823,9 +2035,9 @@ void printRow(int y, int width, room_t** rooms)
         }
     }
     printf("\n");
-    for (int x = 0; x < width; x++)
+    for (int x = 0; x < er->w; x++)
     {
-        if (rooms[x][y].doors[DOOR_DOWN] && rooms[x][y].doors[DOOR_DOWN]->isDoor)
+        if (er->downDoors[x])
         {
             printf("   ");
         }
@@ -836,4 +2048,4 @@ void printRow(int y, int width, room_t** rooms)
     }
     printf("\n");
 }
-#endif
+#endif
\ No newline at end of file
@@ -3,12 +3,27 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <string.h>
+#include "rng.h"
+#include "scratch.h"
 
 //==============================================================================
 // Defines
 //==============================================================================
 
-#define ABS(x) (((x) < 0) ? -(x) : (x))
+#define ABS(x)    (((x) < 0) ? -(x) : (x))
+#define MIN(a, b) (((a) < (b)) ? (a) : (b))
+
+// The most keys a dungeon can have, seven items and ten small keys
+#define MAX_KEYS 17
+
+// Rooms and door slots are indexed with int32_t, and each room owns two door slots
+#define MAX_DUNGEON_ROOMS (INT32_MAX / 2)
+
+// Define MORTON_LAYOUT to store rooms in Z-order instead of row-major order,
+// so rooms near each other in both X and Y are near each other in memory. The
+// width and height must then be powers of two
+// #define MORTON_LAYOUT
 
 //==============================================================================
 // Enums
@@ -56,10 +71,11 @@ typedef enum
 // Structs
 //==============================================================================
 
-struct _door;
-struct _room;
-
-typedef struct _door
+/**
+ * @brief A copy of everything about a single door, see getDoor(). Doors are
+ * stored in dungeon_t's arrays, not as door_t
+ */
+typedef struct
 {
     /**
      * True if this is a door, false if this is a wall
@@ -70,16 +86,16 @@ typedef struct _door
      */
     keyType_t lock;
     /**
-     * temp var, the number of rooms past this door
-     */
-    int16_t numChildren;
-    /**
-     * All the rooms connecting to this door
+     * The indices of the rooms connecting to this door
      */
-    struct _room* rooms[2];
+    int32_t rooms[2];
 } door_t;
 
-typedef struct _room
+/**
+ * @brief A copy of everything about a single room, see getRoom(). Rooms are
+ * stored in dungeon_t's arrays, not as room_t
+ */
+typedef struct
 {
     /** true if this is the starting room */
     bool isStart;
@@ -95,60 +111,583 @@ typedef struct _room
      */
     keyType_t partition;
     /**
-     * This room's set, used for Ellers maze generation algorithm
+     * The indices of the doors connecting to this room, -1 where there is none
      */
-    int32_t set;
+    int32_t doors[4];
+} room_t;
+
+/**
+ * @brief How a room is stored in a dungeon, packed into three bytes
+ */
+typedef struct
+{
+    /** Bitmask of open doors, (1 << doorIdx) for each */
+    uint8_t doors : 4;
+    /** true if this is the starting room */
+    uint8_t isStart : 1;
+    /** true if this is the ending room */
+    uint8_t isEnd : 1;
+    /** true if this is a dead end */
+    uint8_t isDeadEnd : 1;
+    /** The partition this room belongs to, a keyType_t */
+    uint8_t partition;
+    /** The type of treasure in this room, a keyType_t */
+    uint8_t treasure;
+} packedRoom_t;
+
+/**
+ * @brief A dungeon, stored as packed rooms plus one array per door or
+ * traversal field, so that passes over the dungeon only touch the fields they
+ * need. All arrays are in one allocation.
+ *
+ * Rooms are indexed row-major, room (x, y) is (y * w) + x. Each room owns the
+ * door to its right and the door below it, so the door to the right of room r
+ * is r and the door below room r is numRooms + r. The slots for the doors to
+ * the right of the last column and below the last row exist, but are never
+ * doors. Whether a door is open is kept in the doors mask of both rooms it
+ * connects, see openDoor().
+ */
+typedef struct
+{
+    int w;
+    int h;
+    int numRooms;
+    int numDoors;
+#ifdef MORTON_LAYOUT
+    /** The number of low bits of X and Y which are interleaved, log2(MIN(w, h)) */
+    int mortonBits;
+    /** The bits of a room's index which hold its X coordinate */
+    uint32_t xMask;
+    /** The bits of a room's index which hold its Y coordinate */
+    uint32_t yMask;
+#endif
+
+    /** Every room */
+    packedRoom_t* rooms;
+    /** The type of lock for each door slot, a keyType_t */
+    uint8_t* lock;
+
+    // Bitboards, one bit per room in 64 bit words, see boardRow()
+    /** The number of words per row, including a leading word which is always zero */
+    int boardStride;
+    /** A set bit for each room with an open door to its right */
+    uint64_t* rightBoard;
+    /** A set bit for each room with an open door below it */
+    uint64_t* downBoard;
+    /** A set bit for each room whose door to the right is locked */
+    uint64_t* rightLockBoard;
+    /** A set bit for each room whose door below is locked */
+    uint64_t* downLockBoard;
+
+    // Traversal state, only meaningful while generating
+    /** The distance between each room and some other room */
+    int32_t* dist;
+    /** The number of rooms past each room */
+    int32_t* numChildren;
+    /** The number of rooms past each door */
+    int32_t* doorNumChildren;
     /**
-     * All the doors connecting to this room
+     * The traversal which last visited each room. A room has been visited by
+     * the current traversal if its stamp is visitEpoch, see startVisit()
      */
-    door_t* doors[4];
+    uint8_t* visitStamp;
+    uint8_t visitEpoch;
+
+    /** The allocation all arrays and scratch memory live in */
+    void* mem;
+    /** The file mem is mapped from, or NULL if it is on the heap, see mapDungeonToFile() */
+    const char* mapPath;
+    /** The size of mem, in bytes. resetDungeon() reuses it if it is big enough */
+    size_t capacity;
+    /** The number of times mem has been allocated, see getDungeonAllocs() */
+    uint32_t numAllocs;
+    /** Memory for traversals to work in, at the end of mem */
+    scratch_t scratch;
+} dungeon_t;
+
+typedef struct
+{
+    int x;
+    int y;
+} coord_t;
+
+/**
+ * @brief State for Eller's maze generation algorithm, which builds the maze
+ * one row at a time. Only the current row is kept, so memory use is
+ * proportional to the width of the dungeon, not its area.
+ */
+typedef struct
+{
+    int w;
+    int h;
     /**
-     * temp var, the distance between this room and some other room
+     * The row which was generated last, -1 before the first row is generated
      */
-    int16_t dist;
+    int y;
     /**
-     * temp var, whether or not some algorithm has visited this room
+     * The next unused set label
      */
-    bool visited;
+    int32_t nextSet;
     /**
-     * temp var, the number of rooms past this room
+     * Each room's set in the current row, w entries
      */
-    int16_t numChildren;
-} room_t;
+    int32_t* sets;
+    /**
+     * Scratch space to renumber sets between rows, (2 * w) + 1 entries
+     */
+    int32_t* relabel;
+    /**
+     * Disjoint-set forest over set labels, reset every row, (2 * w) + 1 entries.
+     * Two rooms in the current row are connected if their labels have the same root
+     */
+    int32_t* parent;
+    /**
+     * Upper bound on the height of each label's tree, (2 * w) + 1 entries
+     */
+    uint8_t* rank;
+    /**
+     * true for each root label which has a door below it, (2 * w) + 1 entries
+     */
+    bool* setHasDoor;
+    /**
+     * true for each room in the current row with a door above it, w entries
+     */
+    bool* upDoors;
+    /**
+     * true for each room in the current row with a door to its right, w - 1 entries
+     */
+    bool* rightDoors;
+    /**
+     * true for each room in the current row with a door below it, w entries
+     */
+    bool* downDoors;
+    /** The allocation all arrays live in, if initEllersRow() made it */
+    void* mem;
+} ellersRow_t;
 
+/**
+ * @brief Everything needed to draw a single room, independent of how the
+ * dungeon is stored. Packed like packedRoom_t, plus the lock on each door
+ */
 typedef struct
 {
-    room_t** rooms;
-    door_t* doors;
+    /** Bitmask of open doors, (1 << doorIdx) for each */
+    uint8_t doors : 4;
+    /** true if this is the starting room */
+    uint8_t isStart : 1;
+    /** true if this is the ending room */
+    uint8_t isEnd : 1;
+    /** true if this is a dead end */
+    uint8_t isDeadEnd : 1;
+    /** the partition this room belongs to, a keyType_t */
+    uint8_t partition;
+    /** the type of treasure in this room, a keyType_t */
+    uint8_t treasure;
+    /** The lock on each door, EMPTY_ROOM if there is no lock or door */
+    uint8_t locks[DOOR_MAX];
+} roomView_t;
+
+/**
+ * @brief A row of rooms to draw, along with its neighbouring rows
+ */
+typedef struct
+{
+    /** The width of the dungeon */
     int w;
+    /** The height of the dungeon */
     int h;
-    int numDoors;
-} dungeon_t;
+    /** The index of this row */
+    int y;
+    /** The row above this one, NULL for the first row */
+    const roomView_t* above;
+    /** This row */
+    const roomView_t* row;
+    /** The row below this one, NULL for the last row */
+    const roomView_t* below;
+} rowView_t;
 
+/**
+ * @brief State for a single dungeon generator. Nothing in here is shared, so
+ * each thread may own a generator and produce dungeons concurrently.
+ */
 typedef struct
 {
-    int x;
-    int y;
-} coord_t;
+    /**
+     * The random number generator used for every random decision
+     */
+    rng_t rng;
+    /**
+     * The number of threads an algorithm may use, only connectDungeonTiled() uses more than one
+     */
+    int numThreads;
+} genCtx_t;
+
+//==============================================================================
+// Inline functions
+//==============================================================================
+
+#ifdef MORTON_LAYOUT
+/**
+ * @brief Spread the low 16 bits of a value out to the even bits
+ *
+ * @param v The value to spread
+ * @return The spread value
+ */
+static inline uint32_t spreadBits(uint32_t v)
+{
+    v &= 0x0000FFFF;
+    v = (v | (v << 8)) & 0x00FF00FF;
+    v = (v | (v << 4)) & 0x0F0F0F0F;
+    v = (v | (v << 2)) & 0x33333333;
+    v = (v | (v << 1)) & 0x55555555;
+    return v;
+}
+
+/**
+ * @brief Gather the even bits of a value into the low 16 bits, the inverse of
+ * spreadBits()
+ *
+ * @param v The value to gather
+ * @return The gathered value
+ */
+static inline uint32_t gatherBits(uint32_t v)
+{
+    v &= 0x55555555;
+    v = (v | (v >> 1)) & 0x33333333;
+    v = (v | (v >> 2)) & 0x0F0F0F0F;
+    v = (v | (v >> 4)) & 0x00FF00FF;
+    v = (v | (v >> 8)) & 0x0000FFFF;
+    return v;
+}
+#endif
+
+/**
+ * @brief Get the index of a room. With MORTON_LAYOUT the low bits of X and Y
+ * are interleaved, and the high bits of the longer side go on top
+ *
+ * @param dungeon The dungeon the room is in
+ * @param x The X coordinate of the room
+ * @param y The Y coordinate of the room
+ * @return The index of the room
+ */
+static inline int32_t roomIdx(const dungeon_t* dungeon, int x, int y)
+{
+#ifdef MORTON_LAYOUT
+    int bits     = dungeon->mortonBits;
+    uint32_t low = ((uint32_t)1 << bits) - 1;
+    return spreadBits(x & low) | (spreadBits(y & low) << 1) | ((uint32_t)((x | y) >> bits) << (2 * bits));
+#else
+    return (y * dungeon->w) + x;
+#endif
+}
+
+/**
+ * @brief Get the X coordinate of a room
+ *
+ * @param dungeon The dungeon the room is in
+ * @param room The index of the room
+ * @return The X coordinate of the room
+ */
+static inline int roomX(const dungeon_t* dungeon, int32_t room)
+{
+#ifdef MORTON_LAYOUT
+    int bits = dungeon->mortonBits;
+    int high = (dungeon->w > dungeon->h) ? (int)(((uint32_t)room >> (2 * bits)) << bits) : 0;
+    return gatherBits(room & (((uint32_t)1 << (2 * bits)) - 1)) | high;
+#else
+    return room % dungeon->w;
+#endif
+}
+
+/**
+ * @brief Get the Y coordinate of a room
+ *
+ * @param dungeon The dungeon the room is in
+ * @param room The index of the room
+ * @return The Y coordinate of the room
+ */
+static inline int roomY(const dungeon_t* dungeon, int32_t room)
+{
+#ifdef MORTON_LAYOUT
+    int bits = dungeon->mortonBits;
+    int high = (dungeon->h > dungeon->w) ? (int)(((uint32_t)room >> (2 * bits)) << bits) : 0;
+    return gatherBits((room >> 1) & (((uint32_t)1 << (2 * bits)) - 1)) | high;
+#else
+    return room / dungeon->w;
+#endif
+}
+
+/**
+ * @brief Get the index of the i-th room in row-major order. Iterating over
+ * rooms this way visits them in the same order whatever the layout, so random
+ * choices made along the way don't depend on it
+ *
+ * @param dungeon The dungeon the room is in
+ * @param i The position of the room in row-major order
+ * @return The index of the room
+ */
+static inline int32_t rasterRoom(const dungeon_t* dungeon, int32_t i)
+{
+#ifdef MORTON_LAYOUT
+    return roomIdx(dungeon, i % dungeon->w, i / dungeon->w);
+#else
+    (void)dungeon;
+    return i;
+#endif
+}
+
+/**
+ * @brief Get the position of a room in row-major order, the inverse of
+ * rasterRoom()
+ *
+ * @param dungeon The dungeon the room is in
+ * @param room The index of the room
+ * @return The position of the room in row-major order
+ */
+static inline int32_t rasterOrder(const dungeon_t* dungeon, int32_t room)
+{
+#ifdef MORTON_LAYOUT
+    return (roomY(dungeon, room) * dungeon->w) + roomX(dungeon, room);
+#else
+    (void)dungeon;
+    return room;
+#endif
+}
+
+/**
+ * @brief Get the index of the room next to a room. The neighbour must exist
+ *
+ * @param dungeon The dungeon the room is in
+ * @param room The index of the room
+ * @param dir The direction of the neighbour
+ * @return The index of the neighbouring room
+ */
+static inline int32_t roomNeighbour(const dungeon_t* dungeon, int32_t room, doorIdx dir)
+{
+    switch (dir)
+    {
+#ifdef MORTON_LAYOUT
+        // Add or subtract one from just the X or Y bits. Filling the other bits with ones carries straight through them
+        case DOOR_UP:
+        {
+            return (((room & dungeon->yMask) - 1) & dungeon->yMask) | (room & dungeon->xMask);
+        }
+        case DOOR_DOWN:
+        {
+            return (((room | ~dungeon->yMask) + 1) & dungeon->yMask) | (room & dungeon->xMask);
+        }
+        case DOOR_LEFT:
+        {
+            return (((room & dungeon->xMask) - 1) & dungeon->xMask) | (room & dungeon->yMask);
+        }
+        case DOOR_RIGHT:
+        default:
+        {
+            return (((room | ~dungeon->xMask) + 1) & dungeon->xMask) | (room & dungeon->yMask);
+        }
+#else
+        case DOOR_UP:
+        {
+            return room - dungeon->w;
+        }
+        case DOOR_DOWN:
+        {
+            return room + dungeon->w;
+        }
+        case DOOR_LEFT:
+        {
+            return room - 1;
+        }
+        case DOOR_RIGHT:
+        default:
+        {
+            return room + 1;
+        }
+#endif
+    }
+}
+
+/**
+ * @brief Get the slot of the door in some direction from a room. Slots on the
+ * right and bottom edges are never doors, so the slot's isDoor must still be
+ * checked
+ *
+ * @param dungeon The dungeon the room is in
+ * @param room The index of the room
+ * @param dir The direction of the door
+ * @return The index of the door, or -1 if the room is on the top or left edge
+ * and there is no slot
+ */
+static inline int32_t roomDoor(const dungeon_t* dungeon, int32_t room, doorIdx dir)
+{
+    switch (dir)
+    {
+        case DOOR_UP:
+        {
+#ifdef MORTON_LAYOUT
+            return (0 != (room & dungeon->yMask)) ? (dungeon->numRooms + roomNeighbour(dungeon, room, DOOR_UP)) : -1;
+#else
+            return (room >= dungeon->w) ? (dungeon->numRooms + room - dungeon->w) : -1;
+#endif
+        }
+        case DOOR_DOWN:
+        {
+            return dungeon->numRooms + room;
+        }
+        case DOOR_LEFT:
+        {
+#ifdef MORTON_LAYOUT
+            return (0 != (room & dungeon->xMask)) ? roomNeighbour(dungeon, room, DOOR_LEFT) : -1;
+#else
+            return (room > 0) ? (room - 1) : -1;
+#endif
+        }
+        case DOOR_RIGHT:
+        {
+            return room;
+        }
+        default:
+        {
+            return -1;
+        }
+    }
+}
+
+/**
+ * @brief Check if there is an open door in some direction from a room
+ *
+ * @param dungeon The dungeon the room is in
+ * @param room The index of the room
+ * @param dir The direction of the door
+ * @return true if there is a door, false if there is a wall
+ */
+static inline bool hasDoor(const dungeon_t* dungeon, int32_t room, doorIdx dir)
+{
+    return 0 != (dungeon->rooms[room].doors & (1 << dir));
+}
+
+/**
+ * @brief Get a row of a bitboard. Bit x of word x / 64 is room x. The word
+ * before the first and the row above the first row are always zero, so
+ * neighbours may be read without checking edges
+ *
+ * @param dungeon The dungeon the bitboard is in
+ * @param board The bitboard
+ * @param y The row, from -1 to h - 1
+ * @return The first word of the row
+ */
+static inline uint64_t* boardRow(const dungeon_t* dungeon, uint64_t* board, int y)
+{
+    return &board[((y + 1) * dungeon->boardStride) + 1];
+}
+
+/**
+ * @brief Set the bit for a door slot in a pair of right and down bitboards
+ *
+ * @param dungeon The dungeon the bitboards are in
+ * @param rightBoard The bitboard for doors to the right of rooms
+ * @param downBoard The bitboard for doors below rooms
+ * @param door The index of the door slot
+ */
+static inline void setDoorBit(const dungeon_t* dungeon, uint64_t* rightBoard, uint64_t* downBoard, int32_t door)
+{
+    uint64_t* board = (door < dungeon->numRooms) ? rightBoard : downBoard;
+    int32_t room    = (door < dungeon->numRooms) ? door : (door - dungeon->numRooms);
+    int x           = roomX(dungeon, room);
+    boardRow(dungeon, board, roomY(dungeon, room))[x >> 6] |= ((uint64_t)1 << (x & 63));
+}
+
+/**
+ * @brief Open the door in some direction from a room, on both of its sides.
+ * The neighbour must exist
+ *
+ * @param dungeon The dungeon the room is in
+ * @param room The index of the room
+ * @param dir The direction of the door
+ */
+static inline void openDoor(dungeon_t* dungeon, int32_t room, doorIdx dir)
+{
+    dungeon->rooms[room].doors |= (1 << dir);
+    // DOOR_UP and DOOR_DOWN are opposite, as are DOOR_LEFT and DOOR_RIGHT
+    dungeon->rooms[roomNeighbour(dungeon, room, dir)].doors |= (1 << (dir ^ 1));
+    setDoorBit(dungeon, dungeon->rightBoard, dungeon->downBoard, roomDoor(dungeon, room, dir));
+}
+
+/**
+ * @brief Start a traversal, so that no room counts as visited. This only
+ * bumps the epoch; every stamp is cleared once every 255 traversals
+ *
+ * @param dungeon The dungeon to traverse
+ */
+static inline void startVisit(dungeon_t* dungeon)
+{
+    if (0 == ++dungeon->visitEpoch)
+    {
+        memset(dungeon->visitStamp, 0, dungeon->numRooms * sizeof(uint8_t));
+        dungeon->visitEpoch = 1;
+    }
+}
+
+/**
+ * @brief Check if the current traversal has visited a room
+ *
+ * @param dungeon The dungeon being traversed
+ * @param room The index of the room
+ * @return true if the room has been visited since startVisit()
+ */
+static inline bool isVisited(const dungeon_t* dungeon, int32_t room)
+{
+    return dungeon->visitEpoch == dungeon->visitStamp[room];
+}
+
+/**
+ * @brief Mark a room as visited by the current traversal
+ *
+ * @param dungeon The dungeon being traversed
+ * @param room The index of the room
+ */
+static inline void markVisited(dungeon_t* dungeon, int32_t room)
+{
+    dungeon->visitStamp[room] = dungeon->visitEpoch;
+}
 
 //==============================================================================
 // Functions
 //==============================================================================
 
-void initDungeon(dungeon_t* dungeon, int width, int height);
+void initGenCtx(genCtx_t* ctx, uint64_t seed);
+
+bool initDungeon(dungeon_t* dungeon, int width, int height);
+bool resetDungeon(dungeon_t* dungeon, int width, int height);
+void mapDungeonToFile(dungeon_t* dungeon, const char* path);
+uint32_t getDungeonAllocs(const dungeon_t* dungeon);
 void freeDungeon(dungeon_t* dungeon);
 
-void connectDungeonEllers(dungeon_t* dungeon);
-void connectDungeonRecursive(dungeon_t* dungeon);
+bool connectDungeonEllers(genCtx_t* ctx, dungeon_t* dungeon);
+bool connectDungeonRecursive(genCtx_t* ctx, dungeon_t* dungeon);
+bool connectDungeonKruskal(genCtx_t* ctx, dungeon_t* dungeon);
+bool connectDungeonWilson(genCtx_t* ctx, dungeon_t* dungeon);
+bool connectDungeonTiled(genCtx_t* ctx, dungeon_t* dungeon);
+
+size_t ellersRowSize(int width);
+void initEllersRow(ellersRow_t* er, int width, int height, void* mem);
+void nextEllersRow(genCtx_t* ctx, ellersRow_t* er);
+void getEllersRoomViews(const ellersRow_t* er, roomView_t* views);
+void freeEllersRow(ellersRow_t* er);
+
+void getRoomViews(dungeon_t* dungeon, int y, roomView_t* views);
+
+room_t getRoom(dungeon_t* dungeon, int x, int y);
+door_t getDoor(dungeon_t* dungeon, int32_t door);
 
 void clearDungeonDistances(dungeon_t* dungeon);
-coord_t addDistFromRoom(dungeon_t* dungeon, uint16_t startX, uint16_t startY, bool ignoreLocks);
-void countRoomsAfterDoors(dungeon_t* dungeon, uint16_t startX, uint16_t startY);
-
-void setPartitions(dungeon_t* dungeon, room_t* startingRoom, keyType_t partition);
-void markDeadEnds(dungeon_t* dungeon);
-void placeLocks(dungeon_t* dungeon, const keyType_t* goals, int numKeys, coord_t startRoom);
-void placeKeys(dungeon_t* dungeon, const keyType_t* keys, int numKeys);
-void markEnd(dungeon_t* dungeon, coord_t startRoom, keyType_t finalPartition);
+bool addDistFromRoom(dungeon_t* dungeon, int startX, int startY, bool ignoreLocks, coord_t* furthest);
+bool countRoomsAfterDoors(dungeon_t* dungeon, int startX, int startY);
+
+bool setPartitions(dungeon_t* dungeon, coord_t startingRoom, keyType_t partition);
+bool markDeadEnds(dungeon_t* dungeon);
+bool placeLocks(dungeon_t* dungeon, const keyType_t* goals, int numKeys, coord_t startRoom);
+bool placeKeys(genCtx_t* ctx, dungeon_t* dungeon, const keyType_t* keys, int numKeys);
+bool markEnd(dungeon_t* dungeon, coord_t startRoom, keyType_t finalPartition);
 
 #endif
\ No newline at end of file
@@ -1,101 +1,216 @@
 #include <stdlib.h>
 #include <string.h>
 
-#define STBI_ONLY_PNG
-#define STB_IMAGE_IMPLEMENTATION
-#include "stb_image.h"
-#define STB_IMAGE_WRITE_IMPLEMENTATION
-#include "stb_image_write.h"
-
 #include "pngDungeonWriter.h"
 
-#define ROOM_SIZE 5
+#define WALL_COLOR 0xFF000000
 
+static bool checkPngSize(int w, int h, int roomPixels);
 static uint32_t roomColor(keyType_t type, bool isStart, bool isEnd, bool isDeadEnd);
+static void drawRoomRow(const rowView_t* rv, uint32_t* data, int roomPixels);
+
+/**
+ * @brief Set a span of pixels to one color
+ *
+ * @param px The first pixel to set
+ * @param color The color to set, in 0xAARRGGBB form
+ * @param len The number of pixels to set
+ */
+static inline void fillPixels(uint32_t* px, uint32_t color, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+    {
+        px[i] = color;
+    }
+}
 
 /**
  * @brief Save a dungeon as a PNG image
  *
  * @param dungeon The dungeon to save
  * @param name The name to save
+ * @param roomPixels The width and height of each room, in pixels
+ * @return true if the image was saved, false if it couldn't be written
  */
-void saveDungeonPng(dungeon_t* dungeon, const char* name)
+bool saveDungeonPng(dungeon_t* dungeon, const char* name, int roomPixels)
 {
-    uint32_t* data = calloc(dungeon->w * dungeon->h * ROOM_SIZE * ROOM_SIZE, sizeof(uint32_t));
-
+    // Draw and compress one row of rooms at a time, so the whole image is never in memory
+    pngDungeonStream_t stream;
+    if (!openDungeonPngStream(&stream, name, dungeon->w, dungeon->h, roomPixels))
+    {
+        return false;
+    }
+    roomView_t* views = calloc(dungeon->w, sizeof(roomView_t));
+    if (NULL == views)
+    {
+        fprintf(stderr, "Couldn't allocate a row of rooms for %s.png!\n", name);
+        closeDungeonPngStream(&stream);
+        return false;
+    }
     for (int y = 0; y < dungeon->h; y++)
     {
-        for (int x = 0; x < dungeon->w; x++)
-        {
-            int roomIdx = ((y * ROOM_SIZE) * (dungeon->w * ROOM_SIZE)) + (x * ROOM_SIZE);
-            for (int roomY = 0; roomY < ROOM_SIZE; roomY++)
-            {
-                for (int roomX = 0; roomX < ROOM_SIZE; roomX++)
-                {
-                    int pxIdx = roomIdx + (roomY * (dungeon->w * ROOM_SIZE)) + roomX;
-                    if (0 == roomY || 0 == roomX || ROOM_SIZE - 1 == roomY || ROOM_SIZE - 1 == roomX)
-                    {
-                        data[pxIdx] = 0xFF000000;
-                        if (dungeon->rooms[x][y].doors[DOOR_UP] && dungeon->rooms[x][y].doors[DOOR_UP]->isDoor) // up
-                        {
-                            if (0 == roomY && ROOM_SIZE / 2 == roomX)
-                            {
-                                data[pxIdx] = roomColor(dungeon->rooms[x][y].doors[DOOR_UP]->lock, false, false, false);
-                            }
-                        }
+        getRoomViews(dungeon, y, views);
+        rowView_t row = {
+            .w   = dungeon->w,
+            .h   = dungeon->h,
+            .y   = y,
+            .row = views,
+        };
+        writeDungeonPngRow(&stream, &row);
+    }
+    free(views);
+    return closeDungeonPngStream(&stream);
+}
 
-                        if (dungeon->rooms[x][y].doors[DOOR_DOWN]
-                            && dungeon->rooms[x][y].doors[DOOR_DOWN]->isDoor) // down
-                        {
-                            if (ROOM_SIZE - 1 == roomY && ROOM_SIZE / 2 == roomX)
-                            {
-                                data[pxIdx]
-                                    = roomColor(dungeon->rooms[x][y].doors[DOOR_DOWN]->lock, false, false, false);
-                            }
-                        }
+/**
+ * @brief Open a PNG image to write a dungeon into one row of rooms at a time
+ *
+ * @param stream The stream to open
+ * @param name The name to save
+ * @param w The width of the dungeon, in rooms
+ * @param h The height of the dungeon, in rooms
+ * @param roomPixels The width and height of each room, in pixels
+ * @return true if the image was opened, false if it was not
+ */
+bool openDungeonPngStream(pngDungeonStream_t* stream, const char* name, int w, int h, int roomPixels)
+{
+    if (!checkPngSize(w, h, roomPixels))
+    {
+        return false;
+    }
+    size_t nameLen       = strlen(name) + 5;
+    char* nameWithSuffix = malloc(nameLen);
+    if (NULL == nameWithSuffix)
+    {
+        return false;
+    }
+    snprintf(nameWithSuffix, nameLen, "%s.png", name);
+    bool opened = openPngStream(&stream->png, nameWithSuffix, w * roomPixels, h * roomPixels);
+    free(nameWithSuffix);
+    if (!opened)
+    {
+        return false;
+    }
+    stream->roomPixels = roomPixels;
+    stream->data       = malloc((size_t)w * roomPixels * roomPixels * sizeof(uint32_t));
+    if (NULL == stream->data)
+    {
+        fprintf(stderr, "Couldn't allocate a row of pixels for %s.png!\n", name);
+        closePngStream(&stream->png);
+        return false;
+    }
+    return true;
+}
 
-                        if (dungeon->rooms[x][y].doors[DOOR_LEFT]
-                            && dungeon->rooms[x][y].doors[DOOR_LEFT]->isDoor) // left
-                        {
-                            if (0 == roomX && ROOM_SIZE / 2 == roomY)
-                            {
-                                data[pxIdx]
-                                    = roomColor(dungeon->rooms[x][y].doors[DOOR_LEFT]->lock, false, false, false);
-                            }
-                        }
+/**
+ * @brief Write the next row of rooms to a PNG image. Rows must be written in order
+ *
+ * @param stream The stream to write to
+ * @param rv The row to write
+ */
+void writeDungeonPngRow(pngDungeonStream_t* stream, const rowView_t* rv)
+{
+    drawRoomRow(rv, stream->data, stream->roomPixels);
+    writePngScanlines(&stream->png, stream->data, stream->roomPixels);
+}
 
-                        if (dungeon->rooms[x][y].doors[DOOR_RIGHT]
-                            && dungeon->rooms[x][y].doors[DOOR_RIGHT]->isDoor) // right
-                        {
-                            if (ROOM_SIZE - 1 == roomX && ROOM_SIZE / 2 == roomY)
-                            {
-                                data[pxIdx]
-                                    = roomColor(dungeon->rooms[x][y].doors[DOOR_RIGHT]->lock, false, false, false);
-                            }
-                        }
-                    }
-                    else
-                    {
-                        room_t* room = &dungeon->rooms[x][y];
-                        data[pxIdx]  = roomColor(room->partition, room->isStart, room->isEnd, false);
-                        if ((roomX == ROOM_SIZE / 2) && (roomY == ROOM_SIZE / 2))
-                        {
-                            if (EMPTY_ROOM != dungeon->rooms[x][y].treasure || room->isStart || room->isEnd
-                                || room->isDeadEnd)
-                            {
-                                data[pxIdx] = roomColor(room->treasure, room->isStart, room->isEnd, room->isDeadEnd);
-                            }
-                        }
-                    }
-                }
-            }
-        }
+/**
+ * @brief Finish writing a PNG image and close it
+ *
+ * @param stream The stream to close
+ * @return true if the whole image was written, false if any write failed
+ */
+bool closeDungeonPngStream(pngDungeonStream_t* stream)
+{
+    free(stream->data);
+    return closePngStream(&stream->png);
+}
+
+/**
+ * @brief Check that a PNG image of a dungeon can be written
+ *
+ * @param w The width of the dungeon, in rooms
+ * @param h The height of the dungeon, in rooms
+ * @param roomPixels The width and height of each room, in pixels
+ * @return true if the image can be written, false if it can't
+ */
+static bool checkPngSize(int w, int h, int roomPixels)
+{
+    if (roomPixels < PNG_MIN_ROOM_PIXELS)
+    {
+        fprintf(stderr, "Rooms must be at least %d pixels wide in a PNG!\n", PNG_MIN_ROOM_PIXELS);
+        return false;
+    }
+    // PNG images are at most 2^31 - 1 pixels wide and tall
+    if ((int64_t)w * roomPixels > INT32_MAX || (int64_t)h * roomPixels > INT32_MAX)
+    {
+        fprintf(stderr, "A %dx%d dungeon with %d pixel rooms is too big for a PNG!\n", w, h, roomPixels);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Draw a row of rooms. Each scanline is filled in spans, then the doors
+ * and middles are patched in afterwards
+ *
+ * @param rv The row to draw
+ * @param data [out] The pixels to draw to, roomPixels scanlines of (rv->w * roomPixels) pixels
+ * @param roomPixels The width and height of each room, in pixels
+ */
+static void drawRoomRow(const rowView_t* rv, uint32_t* data, int roomPixels)
+{
+    size_t lineLen = (size_t)rv->w * roomPixels;
+    int mid        = roomPixels / 2;
+    uint32_t* top  = data;
+    uint32_t* bot  = &data[(roomPixels - 1) * lineLen];
+
+    // The top and bottom scanlines are all wall, except for doors
+    fillPixels(top, WALL_COLOR, lineLen);
+    fillPixels(bot, WALL_COLOR, lineLen);
+
+    // The scanlines between are a wall, the floor, then a wall for each room
+    uint32_t* inner = &data[lineLen];
+    for (int x = 0; x < rv->w; x++)
+    {
+        const roomView_t* room = &rv->row[x];
+        uint32_t* px           = &inner[(size_t)x * roomPixels];
+        px[0]                  = WALL_COLOR;
+        fillPixels(&px[1], roomColor(room->partition, room->isStart, room->isEnd, false), roomPixels - 2);
+        px[roomPixels - 1] = WALL_COLOR;
+    }
+    for (int line = 2; line < roomPixels - 1; line++)
+    {
+        memcpy(&data[line * lineLen], inner, lineLen * sizeof(uint32_t));
     }
 
-    char nameWithSuffix[strlen(name) + 5];
-    snprintf(nameWithSuffix, sizeof(nameWithSuffix), "%s.png", name);
-    stbi_write_png(nameWithSuffix, dungeon->w * ROOM_SIZE, dungeon->h * ROOM_SIZE, 4, data, 4 * dungeon->w * ROOM_SIZE);
-    free(data);
+    // Patch in the doors and whatever is in the middle of each room
+    uint32_t* midLine = &data[mid * lineLen];
+    for (int x = 0; x < rv->w; x++)
+    {
+        const roomView_t* room = &rv->row[x];
+        size_t left            = (size_t)x * roomPixels;
+        if (room->doors & (1 << DOOR_UP))
+        {
+            top[left + mid] = roomColor(room->locks[DOOR_UP], false, false, false);
+        }
+        if (room->doors & (1 << DOOR_DOWN))
+        {
+            bot[left + mid] = roomColor(room->locks[DOOR_DOWN], false, false, false);
+        }
+        if (room->doors & (1 << DOOR_LEFT))
+        {
+            midLine[left] = roomColor(room->locks[DOOR_LEFT], false, false, false);
+        }
+        if (room->doors & (1 << DOOR_RIGHT))
+        {
+            midLine[left + roomPixels - 1] = roomColor(room->locks[DOOR_RIGHT], false, false, false);
+        }
+        if (EMPTY_ROOM != room->treasure || room->isStart || room->isEnd || room->isDeadEnd)
+        {
+            midLine[left + mid] = roomColor(room->treasure, room->isStart, room->isEnd, room->isDeadEnd);
+        }
+    }
 }
 
 /**
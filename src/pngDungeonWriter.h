@@ -1,5 +1,27 @@
 #pragma once
 
 #include "dungeon.h"
+#include "pngStream.h"
 
-void saveDungeonPng(dungeon_t* dungeon, const char* name);
\ No newline at end of file
+/** The default width and height of a room in a PNG image, in pixels */
+#define PNG_ROOM_PIXELS 5
+/** The smallest room which has space for walls, doors and a middle */
+#define PNG_MIN_ROOM_PIXELS 3
+
+/**
+ * @brief A PNG image which is written one row of rooms at a time
+ */
+typedef struct
+{
+    pngStream_t png;
+    /** Pixels for one row of rooms */
+    uint32_t* data;
+    /** The width and height of each room, in pixels */
+    int roomPixels;
+} pngDungeonStream_t;
+
+bool saveDungeonPng(dungeon_t* dungeon, const char* name, int roomPixels);
+
+bool openDungeonPngStream(pngDungeonStream_t* stream, const char* name, int w, int h, int roomPixels);
+void writeDungeonPngRow(pngDungeonStream_t* stream, const rowView_t* rv);
+bool closeDungeonPngStream(pngDungeonStream_t* stream);
\ No newline at end of file
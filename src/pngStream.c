@@ -0,0 +1,702 @@
+//==============================================================================
+// Includes
+//==============================================================================
+
+#include <stdlib.h>
+#include <string.h>
+#include "pngStream.h"
+#include "bitboard.h"
+
+//==============================================================================
+// Defines
+//==============================================================================
+
+/// The furthest back a match may refer to
+#define WINDOW_SIZE 32768
+/// The number of bits in a hash of three bytes
+#define HASH_BITS 15
+/// The shortest and longest matches deflate can encode
+#define MIN_MATCH 3
+#define MAX_MATCH 258
+/// The most earlier positions to try for each match. More compresses better but slower
+#define MAX_CHAIN 32
+/// The most compressed data in each IDAT chunk
+#define IDAT_SIZE 65536
+
+//==============================================================================
+// Enums
+//==============================================================================
+
+/**
+ * @brief How a scanline is filtered before it is compressed. Dungeons are
+ * flat colors, so the Average and Paeth filters hardly ever beat these and
+ * aren't worth trying
+ */
+typedef enum
+{
+    FILTER_NONE,
+    FILTER_SUB,
+    FILTER_UP,
+    NUM_FILTERS,
+} pngFilter_t;
+
+//==============================================================================
+// Const variables
+//==============================================================================
+
+/// The shortest length of each length symbol, and its number of extra bits
+static const uint16_t lenBase[29] = {3,  4,  5,  6,  7,  8,  9,  10, 11,  13,  15,  17,  19,  23, 27,
+                                     31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+static const uint8_t lenExtra[29]
+    = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+/// The shortest distance of each distance symbol, and its number of extra bits
+static const uint16_t distBase[30]
+    = {1,   2,   3,   4,   5,   7,    9,    13,   17,   25,   33,   49,   65,    97,    129,
+       193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+static const uint8_t distExtra[30]
+    = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+//==============================================================================
+// Functions
+//==============================================================================
+
+/**
+ * @brief Write a 32 bit value, big endian
+ *
+ * @param buf The buffer to write to, must have space for 4 bytes
+ * @param val The value to write
+ */
+static void putBe32(uint8_t* buf, uint32_t val)
+{
+    buf[0] = (val >> 24) & 0xFF;
+    buf[1] = (val >> 16) & 0xFF;
+    buf[2] = (val >> 8) & 0xFF;
+    buf[3] = (val >> 0) & 0xFF;
+}
+
+/**
+ * @brief Write bytes to the file, remembering if the write failed
+ *
+ * @param png The stream to write to
+ * @param data The data to write
+ * @param len The number of bytes to write
+ */
+static void writeBytes(pngStream_t* png, const void* data, size_t len)
+{
+    if (len != fwrite(data, 1, len, png->file))
+    {
+        png->writeError = true;
+    }
+}
+
+/**
+ * @brief Write bytes to the file and add them to a chunk's CRC
+ *
+ * @param png The stream to write to
+ * @param crc [in/out] The running CRC of the chunk
+ * @param data The data to write
+ * @param len The number of bytes to write
+ */
+static void writeCrc(pngStream_t* png, uint32_t* crc, const uint8_t* data, size_t len)
+{
+    uint32_t c = *crc;
+    for (size_t i = 0; i < len; i++)
+    {
+        c = png->crcTable[(c ^ data[i]) & 0xFF] ^ (c >> 8);
+    }
+    *crc = c;
+    writeBytes(png, data, len);
+}
+
+/**
+ * @brief Start a chunk by writing its length and type
+ *
+ * @param png The stream to write to
+ * @param len The length of the chunk's data
+ * @param type The four character type of the chunk
+ * @return The CRC of the chunk so far
+ */
+static uint32_t startChunk(pngStream_t* png, uint32_t len, const char* type)
+{
+    uint8_t lenBytes[4];
+    putBe32(lenBytes, len);
+    writeBytes(png, lenBytes, sizeof(lenBytes));
+
+    uint32_t crc = 0xFFFFFFFF;
+    writeCrc(png, &crc, (const uint8_t*)type, 4);
+    return crc;
+}
+
+/**
+ * @brief End a chunk by writing its CRC
+ *
+ * @param png The stream to write to
+ * @param crc The CRC of the chunk
+ */
+static void endChunk(pngStream_t* png, uint32_t crc)
+{
+    uint8_t crcBytes[4];
+    putBe32(crcBytes, crc ^ 0xFFFFFFFF);
+    writeBytes(png, crcBytes, sizeof(crcBytes));
+}
+
+/**
+ * @brief Add uncompressed data to the running Adler-32
+ *
+ * @param png The stream to update
+ * @param data The data to add
+ * @param len The number of bytes to add
+ */
+static void updateAdler(pngStream_t* png, const uint8_t* data, size_t len)
+{
+    uint32_t a = png->adlerA;
+    uint32_t b = png->adlerB;
+    while (len > 0)
+    {
+        // 5552 is the most bytes which can be summed before b overflows
+        size_t n = (len < 5552) ? len : 5552;
+        len -= n;
+        while (n--)
+        {
+            a += *data++;
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+    }
+    png->adlerA = a;
+    png->adlerB = b;
+}
+
+/**
+ * @brief Reverse the order of the lowest bits of a value. Huffman codes are
+ * written most significant bit first, and everything else least significant bit first
+ *
+ * @param code The value to reverse
+ * @param numBits The number of bits to reverse
+ * @return The reversed value
+ */
+static uint32_t reverseBits(uint32_t code, int numBits)
+{
+    uint32_t rev = 0;
+    for (int i = 0; i < numBits; i++)
+    {
+        rev = (rev << 1) | ((code >> i) & 1);
+    }
+    return rev;
+}
+
+/**
+ * @brief Write the compressed data which has built up as an IDAT chunk
+ *
+ * @param png The stream to write to
+ */
+static void writeIdat(pngStream_t* png)
+{
+    if (0 == png->outLen)
+    {
+        return;
+    }
+    uint32_t crc = startChunk(png, png->outLen, "IDAT");
+    writeCrc(png, &crc, png->out, png->outLen);
+    endChunk(png, crc);
+    png->outLen = 0;
+}
+
+/**
+ * @brief Add bits to the compressed data, least significant bit first
+ *
+ * @param png The stream to write to
+ * @param bits The bits to add
+ * @param numBits The number of bits to add, at most 32
+ */
+static inline void putBits(pngStream_t* png, uint32_t bits, int numBits)
+{
+    deflateStream_t* d = &png->deflate;
+    d->bitBuf |= (uint64_t)bits << d->bitCount;
+    d->bitCount += numBits;
+    while (d->bitCount >= 8)
+    {
+        png->out[png->outLen++] = d->bitBuf & 0xFF;
+        d->bitBuf >>= 8;
+        d->bitCount -= 8;
+        if (IDAT_SIZE == png->outLen)
+        {
+            writeIdat(png);
+        }
+    }
+}
+
+/**
+ * @brief Hash the three bytes at the start of a possible match
+ *
+ * @param data The bytes to hash
+ * @return The hash, HASH_BITS wide
+ */
+static inline uint32_t hashBytes(const uint8_t* data)
+{
+    uint32_t key = ((uint32_t)data[0] << 16) | ((uint32_t)data[1] << 8) | data[2];
+    return (key * 2654435761u) >> (32 - HASH_BITS);
+}
+
+/**
+ * @brief Remember where the three bytes at a position in the window are, for later matches
+ *
+ * @param d The compressor
+ * @param pos The index in the window
+ */
+static inline void insertHash(deflateStream_t* d, int32_t pos)
+{
+    uint32_t hash                      = hashBytes(&d->window[pos]);
+    d->prev[pos & (WINDOW_SIZE - 1)] = d->head[hash];
+    d->head[hash]                      = pos;
+}
+
+/**
+ * @brief Count how many bytes match at two places
+ *
+ * @param a The earlier place
+ * @param b The later place
+ * @param maxLen The most bytes to compare
+ * @return The number of bytes which match, up to maxLen
+ */
+static inline int matchLength(const uint8_t* a, const uint8_t* b, int maxLen)
+{
+    int len = 0;
+    // Compare a word at a time. The first different byte is the lowest set one on little endian machines
+    while (len + 8 <= maxLen)
+    {
+        uint64_t x;
+        uint64_t y;
+        memcpy(&x, &a[len], sizeof(x));
+        memcpy(&y, &b[len], sizeof(y));
+        if (x != y)
+        {
+            return len + (lowestBit(x ^ y) >> 3);
+        }
+        len += 8;
+    }
+    while (len < maxLen && a[len] == b[len])
+    {
+        len++;
+    }
+    return len;
+}
+
+/**
+ * @brief Compress the data in the window. Unless flushing, enough data is left
+ * uncompressed for the longest match, so matches are the same however the data
+ * is fed in
+ *
+ * @param png The stream to write to
+ * @param flush true to compress everything, false to leave space for a match
+ */
+static void compressWindow(pngStream_t* png, bool flush)
+{
+    deflateStream_t* d = &png->deflate;
+    int32_t end        = d->winLen;
+    int32_t limit      = flush ? end : end - MAX_MATCH;
+    while (d->pos < limit)
+    {
+        int32_t pos  = d->pos;
+        int best     = 0;
+        int32_t dist = 0;
+        if (end - pos >= MIN_MATCH)
+        {
+            // Look for the longest match among recent positions with the same hash
+            int maxLen     = (end - pos < MAX_MATCH) ? (end - pos) : MAX_MATCH;
+            uint32_t hash  = hashBytes(&d->window[pos]);
+            int32_t cand   = d->head[hash];
+            for (int chain = 0; chain < MAX_CHAIN && cand >= 0 && pos - cand <= WINDOW_SIZE; chain++)
+            {
+                // Only compare if this could beat the best so far
+                if (d->window[cand + best] == d->window[pos + best])
+                {
+                    int len = matchLength(&d->window[cand], &d->window[pos], maxLen);
+                    if (len > best)
+                    {
+                        best = len;
+                        dist = pos - cand;
+                        if (len == maxLen)
+                        {
+                            break;
+                        }
+                    }
+                }
+
+                // Positions further back than the window have been overwritten
+                int32_t next = d->prev[cand & (WINDOW_SIZE - 1)];
+                if (next >= cand)
+                {
+                    break;
+                }
+                cand = next;
+            }
+            d->prev[pos & (WINDOW_SIZE - 1)] = d->head[hash];
+            d->head[hash]                      = pos;
+        }
+
+        if (best >= MIN_MATCH)
+        {
+            // Write the length, then the distance
+            int lenSym = d->lenSym[best];
+            putBits(png, d->litCode[257 + lenSym], d->litBits[257 + lenSym]);
+            putBits(png, best - lenBase[lenSym], lenExtra[lenSym]);
+            int distSym = (dist <= 256) ? d->distSym[dist - 1] : d->distSym[256 + ((dist - 1) >> 7)];
+            putBits(png, d->distCode[distSym], 5);
+            putBits(png, dist - distBase[distSym], distExtra[distSym]);
+
+            // Remember the positions inside the match too
+            for (int i = 1; i < best && pos + i + MIN_MATCH <= end; i++)
+            {
+                insertHash(d, pos + i);
+            }
+            d->pos += best;
+        }
+        else
+        {
+            uint8_t lit = d->window[pos];
+            putBits(png, d->litCode[lit], d->litBits[lit]);
+            d->pos++;
+        }
+    }
+}
+
+/**
+ * @brief Feed data to be compressed. It is compressed as the window fills up
+ *
+ * @param png The stream to write to
+ * @param data The data to compress
+ * @param len The number of bytes to compress
+ */
+static void deflateBytes(pngStream_t* png, const uint8_t* data, size_t len)
+{
+    deflateStream_t* d = &png->deflate;
+    while (len > 0)
+    {
+        // Once the window is full, slide the last WINDOW_SIZE bytes down to make space
+        if (2 * WINDOW_SIZE == d->winLen)
+        {
+            memmove(d->window, &d->window[WINDOW_SIZE], WINDOW_SIZE);
+            d->winLen -= WINDOW_SIZE;
+            d->pos -= WINDOW_SIZE;
+            for (int i = 0; i < (1 << HASH_BITS); i++)
+            {
+                d->head[i] = (d->head[i] >= WINDOW_SIZE) ? (d->head[i] - WINDOW_SIZE) : -1;
+            }
+            for (int i = 0; i < WINDOW_SIZE; i++)
+            {
+                d->prev[i] = (d->prev[i] >= WINDOW_SIZE) ? (d->prev[i] - WINDOW_SIZE) : -1;
+            }
+        }
+
+        size_t n = 2 * WINDOW_SIZE - d->winLen;
+        if (n > len)
+        {
+            n = len;
+        }
+        memcpy(&d->window[d->winLen], data, n);
+        d->winLen += n;
+        data += n;
+        len -= n;
+        compressWindow(png, false);
+    }
+}
+
+/**
+ * @brief Filter a scanline. Bytes are predicted from the same channel of the
+ * pixel to the left or the pixel above
+ *
+ * @param filter The filter to use
+ * @param cur The scanline to filter
+ * @param prev The scanline above it
+ * @param out [out] The filter type byte, then the filtered scanline
+ * @param stride The size of a scanline, in bytes
+ */
+static void applyFilter(pngFilter_t filter, const uint8_t* cur, const uint8_t* prev, uint8_t* out, size_t stride)
+{
+    out[0] = filter;
+    out++;
+
+    // The first pixel has nothing to its left. Each filter has its own loop so it can be vectorized
+    switch (filter)
+    {
+        case FILTER_NONE:
+        {
+            memcpy(out, cur, stride);
+            break;
+        }
+        case FILTER_SUB:
+        {
+            memcpy(out, cur, 4);
+            for (size_t i = 4; i < stride; i++)
+            {
+                out[i] = cur[i] - cur[i - 4];
+            }
+            break;
+        }
+        case FILTER_UP:
+        {
+            for (size_t i = 0; i < stride; i++)
+            {
+                out[i] = cur[i] - prev[i];
+            }
+            break;
+        }
+        case NUM_FILTERS:
+        {
+            break;
+        }
+    }
+}
+
+/**
+ * @brief Estimate how well a filtered scanline will compress
+ *
+ * @param line The filtered scanline, without its filter type byte
+ * @param stride The size of a scanline, in bytes
+ * @return The sum of the magnitudes of the bytes as signed values, lower is better
+ */
+static uint64_t filterCost(const uint8_t* line, size_t stride)
+{
+    uint64_t cost = 0;
+    for (size_t i = 0; i < stride; i++)
+    {
+        cost += abs((int8_t)line[i]);
+    }
+    return cost;
+}
+
+/**
+ * @brief Filter a scanline into png->filtLine, using whichever filter leaves
+ * the smallest values, which usually compress best
+ *
+ * @param png The stream to filter for
+ * @param cur The scanline to filter. The scanline above it is png->prevLine
+ * @param stride The size of a scanline, in bytes
+ */
+static void filterScanline(pngStream_t* png, const uint8_t* cur, size_t stride)
+{
+    // Scanlines are often repeated, which filters to all zeros
+    if (0 == memcmp(cur, png->prevLine, stride))
+    {
+        png->filtLine[0] = FILTER_UP;
+        memset(&png->filtLine[1], 0, stride);
+        return;
+    }
+
+    uint64_t bestCost = UINT64_MAX;
+    for (pngFilter_t filter = FILTER_NONE; filter < NUM_FILTERS; filter++)
+    {
+        applyFilter(filter, cur, png->prevLine, png->trialLine, stride);
+        uint64_t cost = filterCost(&png->trialLine[1], stride);
+        if (cost < bestCost)
+        {
+            // Keep the best so far
+            bestCost       = cost;
+            uint8_t* best  = png->trialLine;
+            png->trialLine = png->filtLine;
+            png->filtLine  = best;
+        }
+    }
+}
+
+/**
+ * @brief Free the memory of a PNG stream. The file is not touched
+ *
+ * @param png The stream to free
+ */
+static void freePngStream(pngStream_t* png)
+{
+    deflateStream_t* d = &png->deflate;
+    free(d->window);
+    free(d->head);
+    free(d->prev);
+    free(png->prevLine);
+    free(png->filtLine);
+    free(png->trialLine);
+    free(png->out);
+}
+
+/**
+ * @brief Open a PNG file and write its header
+ *
+ * @param png The stream to open
+ * @param fileName The file to write
+ * @param width The width of the image, in pixels
+ * @param height The height of the image, in pixels
+ * @return true if the file was opened, false if it was not
+ */
+bool openPngStream(pngStream_t* png, const char* fileName, int width, int height)
+{
+    png->file = fopen(fileName, "wb");
+    if (NULL == png->file)
+    {
+        fprintf(stderr, "Couldn't open %s for writing!\n", fileName);
+        return false;
+    }
+    png->writeError = false;
+    png->width      = width;
+    png->adlerA     = 1;
+    png->adlerB     = 0;
+    png->prevLine   = calloc(4 * (size_t)width, 1);
+    png->filtLine   = malloc(1 + (4 * (size_t)width));
+    png->trialLine  = malloc(1 + (4 * (size_t)width));
+    png->out        = malloc(IDAT_SIZE);
+    png->outLen     = 0;
+
+    // Build the CRC table
+    for (uint32_t n = 0; n < 256; n++)
+    {
+        uint32_t c = n;
+        for (int k = 0; k < 8; k++)
+        {
+            c = (c & 1) ? (0xEDB88320 ^ (c >> 1)) : (c >> 1);
+        }
+        png->crcTable[n] = c;
+    }
+
+    // Set up the compressor, with nothing in the window
+    deflateStream_t* d = &png->deflate;
+    d->window          = malloc(2 * WINDOW_SIZE);
+    d->winLen          = 0;
+    d->pos             = 0;
+    d->head            = malloc((1 << HASH_BITS) * sizeof(int32_t));
+    d->prev            = malloc(WINDOW_SIZE * sizeof(int32_t));
+    if (NULL == png->prevLine || NULL == png->filtLine || NULL == png->trialLine || NULL == png->out
+        || NULL == d->window || NULL == d->head || NULL == d->prev)
+    {
+        fprintf(stderr, "Couldn't allocate memory to write %s!\n", fileName);
+        freePngStream(png);
+        fclose(png->file);
+        return false;
+    }
+    memset(d->head, 0xFF, (1 << HASH_BITS) * sizeof(int32_t));
+    memset(d->prev, 0xFF, WINDOW_SIZE * sizeof(int32_t));
+    d->bitBuf   = 0;
+    d->bitCount = 0;
+
+    // Build the fixed Huffman codes
+    for (int sym = 0; sym < 288; sym++)
+    {
+        if (sym < 144)
+        {
+            d->litCode[sym] = reverseBits(0x30 + sym, 8);
+            d->litBits[sym] = 8;
+        }
+        else if (sym < 256)
+        {
+            d->litCode[sym] = reverseBits(0x190 + (sym - 144), 9);
+            d->litBits[sym] = 9;
+        }
+        else if (sym < 280)
+        {
+            d->litCode[sym] = reverseBits(sym - 256, 7);
+            d->litBits[sym] = 7;
+        }
+        else
+        {
+            d->litCode[sym] = reverseBits(0xC0 + (sym - 280), 8);
+            d->litBits[sym] = 8;
+        }
+    }
+    for (int sym = 0; sym < 29; sym++)
+    {
+        for (int len = lenBase[sym]; len < lenBase[sym] + (1 << lenExtra[sym]) && len <= MAX_MATCH; len++)
+        {
+            d->lenSym[len] = sym;
+        }
+    }
+    for (int sym = 0; sym < 30; sym++)
+    {
+        d->distCode[sym] = reverseBits(sym, 5);
+        for (int dist = distBase[sym]; dist < distBase[sym] + (1 << distExtra[sym]); dist++)
+        {
+            d->distSym[(dist <= 256) ? (dist - 1) : (256 + ((dist - 1) >> 7))] = sym;
+        }
+    }
+
+    // Signature
+    const uint8_t sig[] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    writeBytes(png, sig, sizeof(sig));
+
+    // Header, 8 bit RGBA, not interlaced
+    uint8_t ihdr[13] = {0};
+    putBe32(&ihdr[0], width);
+    putBe32(&ihdr[4], height);
+    ihdr[8]      = 8;
+    ihdr[9]      = 6;
+    uint32_t crc = startChunk(png, sizeof(ihdr), "IHDR");
+    writeCrc(png, &crc, ihdr, sizeof(ihdr));
+    endChunk(png, crc);
+
+    // zlib header, deflate with a 32K window, then the start of a block with
+    // fixed Huffman codes which lasts until the stream is closed
+    putBits(png, 0x78, 8);
+    putBits(png, 0x01, 8);
+    putBits(png, 1 << 1, 3);
+    return true;
+}
+
+/**
+ * @brief Filter and compress scanlines into a PNG file. They are written as
+ * IDAT chunks whenever enough compressed data builds up. Scanlines must be
+ * written in order, top to bottom
+ *
+ * @param png The stream to write to
+ * @param pixels The pixels to write, numLines rows of png->width pixels
+ * @param numLines The number of scanlines to write
+ */
+void writePngScanlines(pngStream_t* png, const uint32_t* pixels, int numLines)
+{
+    size_t stride = 4 * (size_t)png->width;
+    for (int line = 0; line < numLines; line++)
+    {
+        const uint8_t* cur = (const uint8_t*)&pixels[(size_t)line * png->width];
+        filterScanline(png, cur, stride);
+        updateAdler(png, png->filtLine, 1 + stride);
+        deflateBytes(png, png->filtLine, 1 + stride);
+        memcpy(png->prevLine, cur, stride);
+    }
+}
+
+/**
+ * @brief Finish writing a PNG file and close it
+ *
+ * @param png The stream to close
+ * @return true if the whole file was written, false if any write failed
+ */
+bool closePngStream(pngStream_t* png)
+{
+    deflateStream_t* d = &png->deflate;
+
+    // Compress whatever is left and end the block. Then an empty final block
+    compressWindow(png, true);
+    putBits(png, d->litCode[256], d->litBits[256]);
+    putBits(png, 1 | (1 << 1), 3);
+    putBits(png, d->litCode[256], d->litBits[256]);
+    if (0 != d->bitCount)
+    {
+        putBits(png, 0, 8 - d->bitCount);
+    }
+
+    // Then the Adler-32 of all the data
+    uint32_t adler = (png->adlerB << 16) | png->adlerA;
+    for (int i = 3; i >= 0; i--)
+    {
+        putBits(png, (adler >> (8 * i)) & 0xFF, 8);
+    }
+    writeIdat(png);
+
+    uint32_t crc = startChunk(png, 0, "IEND");
+    endChunk(png, crc);
+    bool written = !png->writeError && !ferror(png->file);
+    written      = (0 == fclose(png->file)) && written;
+    if (!written)
+    {
+        fprintf(stderr, "Couldn't write a PNG file!\n");
+    }
+
+    freePngStream(png);
+    return written;
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * @brief A deflate compressor which is fed a little data at a time. It uses
+ * the fixed Huffman codes and greedy matching over a 32K window
+ */
+typedef struct
+{
+    /** The last 32K of data, which matches may refer to, then the data not yet compressed */
+    uint8_t* window;
+    /** The number of bytes in window */
+    int32_t winLen;
+    /** The index in window of the next byte to compress */
+    int32_t pos;
+    /** The most recent index in window of each hash of three bytes, or -1 */
+    int32_t* head;
+    /** The index in window of the previous three bytes with the same hash, or -1 */
+    int32_t* prev;
+    /** Bits which don't yet fill a byte */
+    uint64_t bitBuf;
+    int bitCount;
+    /** Reversed fixed Huffman code of each literal and length symbol */
+    uint16_t litCode[288];
+    uint8_t litBits[288];
+    /** The length symbol for each match length, minus 257 */
+    uint8_t lenSym[259];
+    /** The distance symbol for each distance minus 1 up to 256, then for each 128 after */
+    uint8_t distSym[512];
+    /** Reversed fixed Huffman code of each distance symbol */
+    uint8_t distCode[30];
+} deflateStream_t;
+
+/**
+ * @brief A PNG file which is written a few scanlines at a time, so the whole
+ * image never needs to be in memory. Pixels are 8 bit RGBA.
+ */
+typedef struct
+{
+    FILE* file;
+    /** true if any write to file failed */
+    bool writeError;
+    /** The width of the image, in pixels */
+    int width;
+    /** Table for the CRC of each chunk */
+    uint32_t crcTable[256];
+    /** Running Adler-32 of all uncompressed data */
+    uint32_t adlerA;
+    uint32_t adlerB;
+    /** The last scanline written, unfiltered */
+    uint8_t* prevLine;
+    /** The filter type byte and filtered pixels of the scanline being written */
+    uint8_t* filtLine;
+    /** Space to try another filter in, to compare with filtLine */
+    uint8_t* trialLine;
+    deflateStream_t deflate;
+    /** Compressed data which hasn't been written as an IDAT chunk yet */
+    uint8_t* out;
+    size_t outLen;
+} pngStream_t;
+
+bool openPngStream(pngStream_t* png, const char* fileName, int width, int height);
+void writePngScanlines(pngStream_t* png, const uint32_t* pixels, int numLines);
+bool closePngStream(pngStream_t* png);
@@ -2,11 +2,26 @@
 // Includes
 //==============================================================================
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <inttypes.h>
 #include "rmdDungeonWriter.h"
 #include "rayTypes.h"
 
+//==============================================================================
+// Defines
+//==============================================================================
+
+// The room stamp cache has (1 << STAMP_SLOT_BITS) slots, and is at most half full
+#define STAMP_SLOT_BITS 11
+// The most memory the room stamps may use, in bytes
+#define STAMP_BUDGET (4 * 1024 * 1024)
+// Define RMD_CHECK_STAMPS to render every room again and check it matches its cached stamp
+
 //==============================================================================
 // Structs
 //==============================================================================
@@ -91,7 +106,49 @@ const rayPair_t rayPairs[] = {
 // Prototypes
 //==============================================================================
 
-static void placeFloor(keyType_t partition, FILE* file);
+static bool openRmd(rmdDungeonStream_t* stream, const char* name, int w, int h, int roomWidth, int roomHeight,
+                    bool carveWalls, int maxObjects, int numRows);
+static void flushRmd(rmdDungeonStream_t* stream);
+static const uint8_t* findRoomStamp(rmdDungeonStream_t* stream, const rowView_t* rv, int x);
+static void renderRoomStamp(const rmdDungeonStream_t* stream, const roomView_t* room, uint8_t sameSides,
+                            uint8_t* stamp);
+static rayMapCellType_t roomObject(const roomView_t* room);
+static rayMapCellType_t floorTile(keyType_t partition);
+static double getTimeS(void);
+
+//==============================================================================
+// Inline functions
+//==============================================================================
+
+/**
+ * @brief Add a byte to an RMD file. It is buffered, and the buffer is written
+ * out when it is full
+ *
+ * @param stream The stream to write to
+ * @param byte The byte to write
+ */
+static inline void putRmdByte(rmdDungeonStream_t* stream, uint8_t byte)
+{
+    if (stream->len == stream->cap)
+    {
+        flushRmd(stream);
+    }
+    stream->buf[stream->len++] = byte;
+}
+
+/**
+ * @brief Add a 32 bit little endian value to an RMD file, see putRmdByte()
+ *
+ * @param stream The stream to write to
+ * @param word The value to write
+ */
+static inline void putRmdWord(rmdDungeonStream_t* stream, uint32_t word)
+{
+    for (int i = 0; i < 4; i++)
+    {
+        putRmdByte(stream, (word >> (8 * i)) & 0xFF);
+    }
+}
 
 //==============================================================================
 // Functions
@@ -138,8 +195,108 @@ static rayMapCellType_t keyTypeToRayType(keyType_t key, bool isDoor)
  * @param roomHeight The number of cells for the height of a room. Must be at least 3
  * @param carveWalls true to carve out walls in a partition, false to leave them
  * @param name The name to save
+ * @param stats [out] How long encoding and writing took, may be NULL
+ */
+void saveDungeonRmd(dungeon_t* dungeon, int roomWidth, int roomHeight, bool carveWalls, const char* name,
+                    rmdStats_t* stats)
+{
+    // The whole file is encoded into one buffer, then written at once
+    double start = getTimeS();
+
+    // Count the objects, to know if their indices fit in the legacy format
+    int numObjects = 0;
+    for (int32_t room = 0; room < dungeon->numRooms; room++)
+    {
+        const packedRoom_t* packed = &dungeon->rooms[room];
+        if (EMPTY_ROOM != packed->treasure || packed->isStart || packed->isEnd)
+        {
+            numObjects++;
+        }
+    }
+
+    rmdDungeonStream_t stream;
+    if (!openRmd(&stream, name, dungeon->w, dungeon->h, roomWidth, roomHeight, carveWalls, numObjects, dungeon->h))
+    {
+        return;
+    }
+
+    // Keep views of the row being written and the rows around it
+    roomView_t* views[3];
+    for (int i = 0; i < 3; i++)
+    {
+        views[i] = calloc(dungeon->w, sizeof(roomView_t));
+    }
+    getRoomViews(dungeon, 0, views[0]);
+
+    for (int y = 0; y < dungeon->h; y++)
+    {
+        if (y < (dungeon->h - 1))
+        {
+            getRoomViews(dungeon, y + 1, views[(y + 1) % 3]);
+        }
+
+        rowView_t row = {
+            .w     = dungeon->w,
+            .h     = dungeon->h,
+            .y     = y,
+            .above = (y > 0) ? views[(y - 1) % 3] : NULL,
+            .row   = views[y % 3],
+            .below = (y < (dungeon->h - 1)) ? views[(y + 1) % 3] : NULL,
+        };
+        writeDungeonRmdRow(&stream, &row);
+    }
+
+    for (int i = 0; i < 3; i++)
+    {
+        free(views[i]);
+    }
+    closeDungeonRmdStream(&stream);
+
+    if (NULL != stats)
+    {
+        stats->writeTime  = stream.writeTime;
+        stats->encodeTime = (getTimeS() - start) - stream.writeTime;
+        stats->size       = stream.size;
+    }
+}
+
+/**
+ * @brief Open an RMD file to write a dungeon into one row of rooms at a time
+ *
+ * @param stream The stream to open
+ * @param name The name to save
+ * @param w The width of the dungeon, in rooms
+ * @param h The height of the dungeon, in rooms
+ * @param roomWidth The number of cells for the width of a room. Must be at least 3
+ * @param roomHeight The number of cells for the height of a room. Must be at least 3
+ * @param carveWalls true to carve out walls in a partition, false to leave them
+ * @param maxObjects The most objects which will be written, to choose the format
+ * @return true if the file was opened, false if it was not
  */
-void saveDungeonRmd(dungeon_t* dungeon, int roomWidth, int roomHeight, bool carveWalls, const char* name)
+bool openDungeonRmdStream(rmdDungeonStream_t* stream, const char* name, int w, int h, int roomWidth, int roomHeight,
+                          bool carveWalls, int maxObjects)
+{
+    // Only buffer about a row at a time, so memory stays proportional to width
+    return openRmd(stream, name, w, h, roomWidth, roomHeight, carveWalls, maxObjects, 1);
+}
+
+/**
+ * @brief Open an RMD file with a buffer big enough for some rows of rooms
+ *
+ * @param stream The stream to open
+ * @param name The name to save
+ * @param w The width of the dungeon, in rooms
+ * @param h The height of the dungeon, in rooms
+ * @param roomWidth The number of cells for the width of a room. Must be at least 3
+ * @param roomHeight The number of cells for the height of a room. Must be at least 3
+ * @param carveWalls true to carve out walls in a partition, false to leave them
+ * @param maxObjects The most objects which will be written, to choose the format
+ * @param numRows The number of rows of rooms to buffer. If it is h, the whole
+ * file is written at once when it is closed
+ * @return true if the file was opened, false if it was not
+ */
+static bool openRmd(rmdDungeonStream_t* stream, const char* name, int w, int h, int roomWidth, int roomHeight,
+                    bool carveWalls, int maxObjects, int numRows)
 {
     // Make sure this is at least 3
     if (roomWidth < 3)
@@ -152,6 +309,251 @@ void saveDungeonRmd(dungeon_t* dungeon, int roomWidth, int roomHeight, bool carv
         roomHeight = 3;
     }
 
+    stream->roomWidth  = roomWidth;
+    stream->roomHeight = roomHeight;
+    stream->carveWalls = carveWalls;
+    stream->objIdx     = 0;
+    stream->writeTime  = 0;
+    stream->size       = 0;
+
+    // Small maps keep the legacy format, which any reader understands
+    uint64_t mapW = (uint64_t)w * roomWidth;
+    uint64_t mapH = (uint64_t)h * roomHeight;
+    if (mapW > UINT32_MAX || mapH > UINT32_MAX)
+    {
+        fprintf(stderr, "A %" PRIu64 "x%" PRIu64 " map is too big for an RMD file!\n", mapW, mapH);
+        return false;
+    }
+    stream->extended
+        = (mapW > RMD_LEGACY_MAX_SIZE || mapH > RMD_LEGACY_MAX_SIZE || maxObjects > RMD_LEGACY_MAX_OBJECTS);
+    stream->idxSize  = stream->extended ? 4 : 1;
+
+    // Stamps are cached until the budget or the slots run out
+    stream->stampSize = (size_t)2 * roomWidth * roomHeight;
+    stream->maxStamps = MIN(STAMP_BUDGET / stream->stampSize, 1 << (STAMP_SLOT_BITS - 1));
+    stream->maxStamps = (stream->maxStamps < 1) ? 1 : stream->maxStamps;
+    stream->numStamps = 0;
+
+    // Open a file
+    size_t nameLen       = strlen(name) + 5;
+    char* nameWithSuffix = malloc(nameLen);
+    snprintf(nameWithSuffix, nameLen, "%s.rmd", name);
+    stream->file = fopen(nameWithSuffix, "wb");
+    if (NULL == stream->file)
+    {
+        fprintf(stderr, "Couldn't open %s for writing!\n", nameWithSuffix);
+        free(nameWithSuffix);
+        return false;
+    }
+    free(nameWithSuffix);
+
+    // Each cell is a background and an object byte, and each room may have an object index.
+    // Add the header before and the script count after
+    size_t rowSize = ((size_t)2 * w * roomWidth * roomHeight) + ((size_t)w * stream->idxSize);
+    stream->cap    = RMD_EXT_HEADER_SIZE + (rowSize * numRows) + 4;
+    stream->len    = 0;
+    stream->buf       = malloc(stream->cap);
+    stream->stampKeys = calloc((size_t)1 << STAMP_SLOT_BITS, sizeof(uint64_t));
+    stream->stampIdx  = malloc(sizeof(int32_t) << STAMP_SLOT_BITS);
+    stream->stamps    = malloc(stream->maxStamps * stream->stampSize);
+    if (NULL == stream->buf || NULL == stream->stampKeys || NULL == stream->stampIdx || NULL == stream->stamps)
+    {
+        fprintf(stderr, "Couldn't allocate %zu bytes for %s.rmd!\n", stream->cap, name);
+        fclose(stream->file);
+        free(stream->buf);
+        free(stream->stampKeys);
+        free(stream->stampIdx);
+        free(stream->stamps);
+        return false;
+    }
+
+    // Write dimensions
+    if (stream->extended)
+    {
+        // A legacy size of zero marks the extended format
+        putRmdByte(stream, 0);
+        putRmdByte(stream, 0);
+        putRmdByte(stream, RMD_EXT_VERSION);
+        putRmdWord(stream, mapW);
+        putRmdWord(stream, mapH);
+    }
+    else
+    {
+        putRmdByte(stream, mapW);
+        putRmdByte(stream, mapH);
+    }
+    return true;
+}
+
+/**
+ * @brief Write the next row of rooms to an RMD file. Rows must be written in order.
+ * Each room is copied from a stamp of its cells, which is only rendered the
+ * first time a room with the same signature is seen, see findRoomStamp()
+ *
+ * @param stream The stream to write to
+ * @param rv The row to write, along with its neighbours
+ */
+void writeDungeonRmdRow(rmdDungeonStream_t* stream, const rowView_t* rv)
+{
+    int roomWidth  = stream->roomWidth;
+    int roomHeight = stream->roomHeight;
+    int idxSize    = stream->idxSize;
+
+    // The whole row of rooms is written into the buffer at once
+    size_t lineSize = (size_t)2 * rv->w * roomWidth;
+    if (stream->cap - stream->len < (lineSize * roomHeight) + ((size_t)rv->w * idxSize))
+    {
+        flushRmd(stream);
+    }
+
+    // Only the middle line of cells has object indices, after each room's object
+    int midLine    = roomHeight / 2;
+    int midCell    = roomWidth / 2;
+    int numObjects = 0;
+    for (int x = 0; x < rv->w; x++)
+    {
+        if (EMPTY != roomObject(&rv->row[x]))
+        {
+            numObjects++;
+        }
+    }
+
+    uint8_t* rowStart = &stream->buf[stream->len];
+    int objectsSoFar  = 0;
+    for (int x = 0; x < rv->w; x++)
+    {
+        const roomView_t* room = &rv->row[x];
+        const uint8_t* stamp   = findRoomStamp(stream, rv, x);
+        bool hasObject         = (EMPTY != roomObject(room));
+        for (int line = 0; line < roomHeight; line++)
+        {
+            uint8_t* dst = rowStart + (line * lineSize) + ((line > midLine) ? (numObjects * idxSize) : 0)
+                           + ((size_t)2 * x * roomWidth) + ((line == midLine) ? (objectsSoFar * idxSize) : 0);
+            const uint8_t* src = &stamp[2 * line * roomWidth];
+            if (line == midLine && hasObject)
+            {
+                // Split the line after the object to insert its index, little endian
+                int split = (2 * midCell) + 2;
+                memcpy(dst, src, split);
+                for (int i = 0; i < idxSize; i++)
+                {
+                    dst[split + i] = ((uint32_t)stream->objIdx >> (8 * i)) & 0xFF;
+                }
+                stream->objIdx++;
+                memcpy(&dst[split + idxSize], &src[split], (2 * roomWidth) - split);
+            }
+            else
+            {
+                memcpy(dst, src, 2 * roomWidth);
+            }
+        }
+        if (hasObject)
+        {
+            objectsSoFar++;
+        }
+    }
+    stream->len += (lineSize * roomHeight) + ((size_t)numObjects * idxSize);
+}
+
+/**
+ * @brief Get the stamp of a room's cells, rendering it if no room with the
+ * same signature has been rendered yet. A room's cells only depend on its
+ * doors, locks, partition and object, and on which neighbours share its
+ * partition when walls are carved
+ *
+ * @param stream The stream the stamps belong to
+ * @param rv The row the room is in, along with its neighbours
+ * @param x The X coordinate of the room
+ * @return The stamp, two bytes per cell in rows. It is valid until the next call
+ */
+static const uint8_t* findRoomStamp(rmdDungeonStream_t* stream, const rowView_t* rv, int x)
+{
+    const roomView_t* room = &rv->row[x];
+
+    // Note which sides have a neighbour in the same partition, one bit per doorIdx
+    uint8_t sameSides = 0;
+    if (stream->carveWalls)
+    {
+        if ((NULL != rv->above) && (rv->above[x].partition == room->partition))
+        {
+            sameSides |= (1 << DOOR_UP);
+        }
+        if ((NULL != rv->below) && (rv->below[x].partition == room->partition))
+        {
+            sameSides |= (1 << DOOR_DOWN);
+        }
+        if ((x > 0) && (rv->row[x - 1].partition == room->partition))
+        {
+            sameSides |= (1 << DOOR_LEFT);
+        }
+        if ((x < (rv->w - 1)) && (rv->row[x + 1].partition == room->partition))
+        {
+            sameSides |= (1 << DOOR_RIGHT);
+        }
+    }
+
+    // Pack the signature, each field in its own bits. The top bit is set so that zero marks an empty slot
+    uint64_t key = ((uint64_t)1 << 63) | ((uint64_t)(room->doors & 0x0F) << 52) | ((uint64_t)(sameSides & 0x0F) << 48)
+                   | ((uint64_t)(roomObject(room) & 0xFF) << 40) | ((uint64_t)(room->partition & 0xFF) << 32)
+                   | ((uint64_t)(room->locks[DOOR_UP] & 0xFF) << 24) | ((uint64_t)(room->locks[DOOR_DOWN] & 0xFF) << 16)
+                   | ((uint64_t)(room->locks[DOOR_LEFT] & 0xFF) << 8) | (uint64_t)(room->locks[DOOR_RIGHT] & 0xFF);
+
+    // Look for it, probing linearly from its hash
+    uint32_t slot = (uint32_t)((key * 0x9E3779B97F4A7C15ULL) >> (64 - STAMP_SLOT_BITS));
+    while (0 != stream->stampKeys[slot])
+    {
+        if (key == stream->stampKeys[slot])
+        {
+            const uint8_t* stamp = &stream->stamps[(size_t)stream->stampIdx[slot] * stream->stampSize];
+#ifdef RMD_CHECK_STAMPS
+            uint8_t* check = malloc(stream->stampSize);
+            renderRoomStamp(stream, room, sameSides, check);
+            if (0 != memcmp(check, stamp, stream->stampSize))
+            {
+                fprintf(stderr, "Room (%d, %d) doesn't match its cached stamp!\n", x, rv->y);
+                abort();
+            }
+            free(check);
+#endif
+            return stamp;
+        }
+        slot = (slot + 1) & ((1 << STAMP_SLOT_BITS) - 1);
+    }
+
+    // Not found. If the cache is full, start it over
+    if (stream->numStamps == stream->maxStamps)
+    {
+        memset(stream->stampKeys, 0, sizeof(stream->stampKeys[0]) << STAMP_SLOT_BITS);
+        stream->numStamps = 0;
+        slot              = (uint32_t)((key * 0x9E3779B97F4A7C15ULL) >> (64 - STAMP_SLOT_BITS));
+    }
+    stream->stampKeys[slot] = key;
+    stream->stampIdx[slot]  = stream->numStamps;
+    uint8_t* stamp          = &stream->stamps[(size_t)stream->numStamps * stream->stampSize];
+    stream->numStamps++;
+    renderRoomStamp(stream, room, sameSides, stamp);
+    return stamp;
+}
+
+/**
+ * @brief Render a room's cells, without its object index
+ *
+ * @param stream The stream the room is written to
+ * @param room The room to render
+ * @param sameSides A bit per doorIdx, set if the neighbour on that side is in the
+ * same partition and walls are carved
+ * @param stamp [out] Written with two bytes per cell, in rows
+ */
+static void renderRoomStamp(const rmdDungeonStream_t* stream, const roomView_t* room, uint8_t sameSides,
+                            uint8_t* stamp)
+{
+    int roomWidth  = stream->roomWidth;
+    int roomHeight = stream->roomHeight;
+    bool sameUp    = (0 != (sameSides & (1 << DOOR_UP)));
+    bool sameDown  = (0 != (sameSides & (1 << DOOR_DOWN)));
+    bool sameLeft  = (0 != (sameSides & (1 << DOOR_LEFT)));
+    bool sameRight = (0 != (sameSides & (1 << DOOR_RIGHT)));
+
     // Array to check doors easier
     doorCheck_t dc[] = {
         {
@@ -176,226 +578,232 @@ void saveDungeonRmd(dungeon_t* dungeon, int roomWidth, int roomHeight, bool carv
         },
     };
 
-    int objIdx = 0;
-    // Open a file
-    char nameWithSuffix[strlen(name) + 5];
-    snprintf(nameWithSuffix, sizeof(nameWithSuffix), "%s.rmd", name);
-    FILE* file = fopen(nameWithSuffix, "wb");
-    if (NULL == file)
+    uint8_t* cell = stamp;
+    for (int roomY = 0; roomY < roomHeight; roomY++)
     {
-        fprintf(stderr, "Couldn't open %s for writing!\n", nameWithSuffix);
-        return;
-    }
-    // Write dimensions
-    fputc(dungeon->w * roomWidth, file);
-    fputc(dungeon->h * roomHeight, file);
-
-    for (int y = 0; y < dungeon->h; y++)
-    {
-        for (int roomY = 0; roomY < roomHeight; roomY++)
+        for (int roomX = 0; roomX < roomWidth; roomX++)
         {
-            for (int x = 0; x < dungeon->w; x++)
+            // If this is a boundary
+            if ((roomX == 0) || (roomX == (roomWidth - 1)) || (roomY == 0) || (roomY == (roomHeight - 1)))
             {
-                for (int roomX = 0; roomX < roomWidth; roomX++)
+                bool doorPlaced = false;
+                for (int d = 0; d < (int)(sizeof(dc) / sizeof(dc[0])); d++)
                 {
-                    // If this is a boundary
-                    if ((roomX == 0) || (roomX == (roomWidth - 1)) || (roomY == 0) || (roomY == (roomHeight - 1)))
+                    if ((room->doors & (1 << dc[d].door)) && //
+                        ((dc[d].yDoor == roomY) &&           //
+                         (dc[d].xDoor == roomX)))
                     {
-                        bool doorPlaced = false;
-                        for (int d = 0; d < (int)(sizeof(dc) / sizeof(dc[0])); d++)
+                        keyType_t key = room->locks[dc[d].door];
+                        if ((EMPTY_ROOM == key) || (EMPTY_ROOM != room->locks[DOOR_LEFT])
+                            || (EMPTY_ROOM != room->locks[DOOR_UP]))
                         {
-                            if (dungeon->rooms[x][y].doors[dc[d].door] &&         //
-                                dungeon->rooms[x][y].doors[dc[d].door]->isDoor && //
-                                ((dc[d].yDoor == roomY) &&                        //
-                                 (dc[d].xDoor == roomX)))
-                            {
-                                keyType_t key = dungeon->rooms[x][y].doors[dc[d].door]->lock;
-                                if ((EMPTY_ROOM == key)
-                                    || (dungeon->rooms[x][y].doors[DOOR_LEFT]
-                                        && (EMPTY_ROOM != dungeon->rooms[x][y].doors[DOOR_LEFT]->lock))
-                                    || (dungeon->rooms[x][y].doors[DOOR_UP]
-                                        && (EMPTY_ROOM != dungeon->rooms[x][y].doors[DOOR_UP]->lock)))
-                                {
-                                    // For empty rooms or if an adjacent door was already placed,
-                                    // place floor according to partition
-                                    placeFloor(dungeon->rooms[x][y].partition, file);
-                                }
-                                else
-                                {
-                                    // Place the door according ot the lock type
-                                    fputc(keyTypeToRayType(key, true), file);
-                                }
-                                doorPlaced = true;
-                                break;
-                            }
+                            // For empty rooms or if an adjacent door was already placed,
+                            // place floor according to partition
+                            *cell++ = floorTile(room->partition);
                         }
-
-                        // If a door wasn't placed
-                        if (!doorPlaced)
+                        else
                         {
-                            // If an adjacent cell is part of the same partition, don't draw a wall there
-                            bool adjacentIsSamePartition = false;
-
-                            if (carveWalls)
-                            {
-                                // Left wall
-                                if ((0 == roomX) &&                                //
-                                    ((0 < roomY) && (roomY < (roomHeight - 1))) && //
-                                    (x > 0) &&                                     //
-                                    (dungeon->rooms[x - 1][y].partition == dungeon->rooms[x][y].partition))
-                                {
-                                    adjacentIsSamePartition = true;
-                                }
-                                // Right wall
-                                if (((roomWidth - 1) == roomX) &&                  //
-                                    ((0 < roomY) && (roomY < (roomHeight - 1))) && //
-                                    (x < (dungeon->w - 1)) &&                      //
-                                    (dungeon->rooms[x + 1][y].partition == dungeon->rooms[x][y].partition))
-                                {
-                                    adjacentIsSamePartition = true;
-                                }
-
-                                // Top wall
-                                if ((0 == roomY) &&                               //
-                                    ((0 < roomX) && (roomX < (roomWidth - 1))) && //
-                                    (y > 0) &&                                    //
-                                    (dungeon->rooms[x][y - 1].partition == dungeon->rooms[x][y].partition))
-                                {
-                                    adjacentIsSamePartition = true;
-                                }
-                                // Bottom wall
-                                if (((roomHeight - 1) == roomY) &&                //
-                                    ((0 < roomX) && (roomX < (roomWidth - 1))) && //
-                                    (y < (dungeon->h - 1)) &&                     //
-                                    (dungeon->rooms[x][y + 1].partition == dungeon->rooms[x][y].partition))
-                                {
-                                    adjacentIsSamePartition = true;
-                                }
-
-                                // Top Left
-                                if ((0 == roomX && 0 == roomY) &&                                           //
-                                    (x > 0 && y > 0) &&                                                     //
-                                    dungeon->rooms[x][y].partition == dungeon->rooms[x - 1][y].partition && //
-                                    dungeon->rooms[x][y].partition == dungeon->rooms[x][y - 1].partition)
-                                {
-                                    adjacentIsSamePartition = true;
-                                }
-                                // Bottom Left
-                                if ((0 == roomX && (roomHeight - 1) == roomY) &&                            //
-                                    (x > 0 && y < (dungeon->h - 1)) &&                                      //
-                                    dungeon->rooms[x][y].partition == dungeon->rooms[x - 1][y].partition && //
-                                    dungeon->rooms[x][y].partition == dungeon->rooms[x][y + 1].partition)
-                                {
-                                    adjacentIsSamePartition = true;
-                                }
-
-                                // Top Right
-                                if (((roomWidth - 1) == roomX && 0 == roomY) &&                             //
-                                    (x < (dungeon->w - 1) && y > 0) &&                                      //
-                                    dungeon->rooms[x][y].partition == dungeon->rooms[x + 1][y].partition && //
-                                    dungeon->rooms[x][y].partition == dungeon->rooms[x][y - 1].partition)
-                                {
-                                    adjacentIsSamePartition = true;
-                                }
-                                // Bottom Right
-                                if (((roomWidth - 1) == roomX && (roomHeight - 1) == roomY) &&              //
-                                    (x < (dungeon->w - 1) && y < (dungeon->h - 1)) &&                       //
-                                    dungeon->rooms[x][y].partition == dungeon->rooms[x + 1][y].partition && //
-                                    dungeon->rooms[x][y].partition == dungeon->rooms[x][y + 1].partition)
-                                {
-                                    adjacentIsSamePartition = true;
-                                }
-                            }
-
-                            // If adjacent cells are the same partition
-                            if (adjacentIsSamePartition)
-                            {
-                                // Put some floor
-                                placeFloor(dungeon->rooms[x][y].partition, file);
-                            }
-                            else
-                            {
-                                // Put a wall, style based on partition
-                                fputc(BG_WALL_1 + (dungeon->rooms[x][y].partition % (BG_WALL_5 - BG_WALL_1 + 1)), file);
-                            }
+                            // Place the door according ot the lock type
+                            *cell++ = keyTypeToRayType(key, true);
                         }
+                        doorPlaced = true;
+                        break;
+                    }
+                }
+
+                // If a door wasn't placed
+                if (!doorPlaced)
+                {
+                    // If an adjacent cell is part of the same partition, don't draw a wall there
+                    bool adjacentIsSamePartition = false;
+                    bool isSide                  = (0 < roomY) && (roomY < (roomHeight - 1));
+                    bool isTopOrBottom           = (0 < roomX) && (roomX < (roomWidth - 1));
 
-                        // No object on this tile
-                        fputc(EMPTY, file);
+                    // Left wall
+                    if ((0 == roomX) && isSide && sameLeft)
+                    {
+                        adjacentIsSamePartition = true;
                     }
-                    else
+                    // Right wall
+                    if (((roomWidth - 1) == roomX) && isSide && sameRight)
                     {
-                        // Otherwise put some floor
-                        placeFloor(dungeon->rooms[x][y].partition, file);
+                        adjacentIsSamePartition = true;
+                    }
 
-                        // Place an object, maybe
-                        if ((roomX == roomWidth / 2) && (roomY == roomHeight / 2))
-                        {
-                            rayMapCellType_t itemType = EMPTY;
-                            room_t* room              = &dungeon->rooms[x][y];
-                            if (EMPTY_ROOM != dungeon->rooms[x][y].treasure)
-                            {
-                                itemType = keyTypeToRayType(room->treasure, false);
-                            }
-                            else if (room->isStart)
-                            {
-                                itemType = OBJ_ENEMY_START_POINT;
-                            }
-                            else if (room->isEnd)
-                            {
-                                itemType = OBJ_ITEM_ARTIFACT;
-                            }
-                            // else if (room->isDeadEnd)
-                            // {
-                            //     itemType = OBJ_ITEM_PICKUP_ENERGY;
-                            // }
-
-                            fputc(itemType, file);
-                            if (EMPTY != itemType)
-                            {
-                                fputc(objIdx++, file);
-                            }
-                        }
-                        else
-                        {
-                            // No item
-                            fputc(EMPTY, file);
-                        }
+                    // Top wall
+                    if ((0 == roomY) && isTopOrBottom && sameUp)
+                    {
+                        adjacentIsSamePartition = true;
+                    }
+                    // Bottom wall
+                    if (((roomHeight - 1) == roomY) && isTopOrBottom && sameDown)
+                    {
+                        adjacentIsSamePartition = true;
                     }
+
+                    // Top Left
+                    if ((0 == roomX && 0 == roomY) && sameLeft && sameUp)
+                    {
+                        adjacentIsSamePartition = true;
+                    }
+                    // Bottom Left
+                    if ((0 == roomX && (roomHeight - 1) == roomY) && sameLeft && sameDown)
+                    {
+                        adjacentIsSamePartition = true;
+                    }
+
+                    // Top Right
+                    if (((roomWidth - 1) == roomX && 0 == roomY) && sameRight && sameUp)
+                    {
+                        adjacentIsSamePartition = true;
+                    }
+                    // Bottom Right
+                    if (((roomWidth - 1) == roomX && (roomHeight - 1) == roomY) && sameRight && sameDown)
+                    {
+                        adjacentIsSamePartition = true;
+                    }
+
+                    // If adjacent cells are the same partition
+                    if (adjacentIsSamePartition)
+                    {
+                        // Put some floor
+                        *cell++ = floorTile(room->partition);
+                    }
+                    else
+                    {
+                        // Put a wall, style based on partition
+                        *cell++ = BG_WALL_1 + (room->partition % (BG_WALL_5 - BG_WALL_1 + 1));
+                    }
+                }
+
+                // No object on this tile
+                *cell++ = EMPTY;
+            }
+            else
+            {
+                // Otherwise put some floor
+                *cell++ = floorTile(room->partition);
+
+                // Place an object, maybe. Its index is added when the stamp is copied
+                if ((roomX == roomWidth / 2) && (roomY == roomHeight / 2))
+                {
+                    *cell++ = roomObject(room);
+                }
+                else
+                {
+                    // No item
+                    *cell++ = EMPTY;
                 }
             }
         }
     }
+}
+
+/**
+ * @brief Get the object in the middle of a room
+ *
+ * @param room The room to get the object of
+ * @return The object, EMPTY if there is none
+ */
+static rayMapCellType_t roomObject(const roomView_t* room)
+{
+    if (EMPTY_ROOM != room->treasure)
+    {
+        return keyTypeToRayType(room->treasure, false);
+    }
+    else if (room->isStart)
+    {
+        return OBJ_ENEMY_START_POINT;
+    }
+    else if (room->isEnd)
+    {
+        return OBJ_ITEM_ARTIFACT;
+    }
+    // else if (room->isDeadEnd)
+    // {
+    //     return OBJ_ITEM_PICKUP_ENERGY;
+    // }
+    return EMPTY;
+}
+
+/**
+ * @brief Finish writing an RMD file and close it
+ *
+ * @param stream The stream to close
+ */
+void closeDungeonRmdStream(rmdDungeonStream_t* stream)
+{
     // No scripts
-    fputc(0, file);
-    fclose(file);
+    if (stream->extended)
+    {
+        putRmdWord(stream, 0);
+    }
+    else
+    {
+        putRmdByte(stream, 0);
+    }
+    flushRmd(stream);
+
+    double start = getTimeS();
+    fclose(stream->file);
+    stream->writeTime += getTimeS() - start;
+    free(stream->buf);
+    free(stream->stampKeys);
+    free(stream->stampIdx);
+    free(stream->stamps);
 }
 
 /**
- * @brief Place a floor tile according to partition
+ * @brief Write out everything buffered for an RMD file
  *
- * @param partition
- * @param file
+ * @param stream The stream to write out
  */
-static void placeFloor(keyType_t partition, FILE* file)
+static void flushRmd(rmdDungeonStream_t* stream)
+{
+    double start = getTimeS();
+    if (stream->len != fwrite(stream->buf, 1, stream->len, stream->file))
+    {
+        fprintf(stderr, "Couldn't write an RMD file!\n");
+    }
+    stream->writeTime += getTimeS() - start;
+    stream->size += stream->len;
+    stream->len = 0;
+}
+
+/**
+ * @brief Get the floor tile for a partition
+ *
+ * @param partition The partition the tile is in
+ * @return The floor tile
+ */
+static rayMapCellType_t floorTile(keyType_t partition)
 {
     // Put some floor
     switch (keyTypeToRayType(partition, true))
     {
         case BG_FLOOR_LAVA:
         {
-            fputc(BG_FLOOR_LAVA, file);
-            break;
+            return BG_FLOOR_LAVA;
         }
         case BG_FLOOR_WATER:
         {
-            fputc(BG_FLOOR_WATER, file);
-            break;
+            return BG_FLOOR_WATER;
         }
         default:
         {
-            fputc(BG_FLOOR, file);
-            break;
+            return BG_FLOOR;
         }
     }
-}
\ No newline at end of file
+}
+
+/**
+ * @brief Get the time from the monotonic clock in seconds
+ *
+ * @return The time in seconds
+ */
+static double getTimeS(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
@@ -1,5 +1,67 @@
 #pragma once
 
+#include <stdio.h>
 #include "dungeon.h"
 
-void saveDungeonRmd(dungeon_t* dungeon, int roomWidth, int roomHeight, bool carveWalls, const char* name);
+// The legacy RMD format stores the map's width and height and each object's index in one byte each. It is used
+// whenever they fit. Otherwise the extended format starts with a zero width and height, then a version byte, then the
+// width and height as 32 bit little endian values. Its object indices and script count are 32 bit little endian too
+#define RMD_LEGACY_MAX_SIZE    255
+#define RMD_LEGACY_MAX_OBJECTS 256
+#define RMD_EXT_VERSION        1
+#define RMD_EXT_HEADER_SIZE    11
+
+/**
+ * @brief An RMD file which is written one row of rooms at a time
+ */
+typedef struct
+{
+    FILE* file;
+    int roomWidth;
+    int roomHeight;
+    bool carveWalls;
+    /** The index of the next object placed */
+    int objIdx;
+    /** true if this is written in the extended format, see RMD_EXT_VERSION */
+    bool extended;
+    /** The number of bytes in each object index */
+    int idxSize;
+    /** Bytes waiting to be written, see putRmdByte() */
+    uint8_t* buf;
+    size_t len;
+    size_t cap;
+    /** The number of bytes written to the file so far */
+    size_t size;
+    /** Seconds spent writing buf to the file */
+    double writeTime;
+    /** Hash slots of rendered room signatures, zero for empty slots, see findRoomStamp() */
+    uint64_t* stampKeys;
+    /** The stamp for each slot's signature */
+    int32_t* stampIdx;
+    /** Rendered rooms, stampSize bytes each */
+    uint8_t* stamps;
+    size_t stampSize;
+    int numStamps;
+    int maxStamps;
+} rmdDungeonStream_t;
+
+/**
+ * @brief How long saving an RMD file took
+ */
+typedef struct
+{
+    /** Seconds spent turning rooms into bytes */
+    double encodeTime;
+    /** Seconds spent writing the bytes to the file */
+    double writeTime;
+    /** The size of the file, in bytes */
+    size_t size;
+} rmdStats_t;
+
+void saveDungeonRmd(dungeon_t* dungeon, int roomWidth, int roomHeight, bool carveWalls, const char* name,
+                    rmdStats_t* stats);
+
+bool openDungeonRmdStream(rmdDungeonStream_t* stream, const char* name, int w, int h, int roomWidth, int roomHeight,
+                          bool carveWalls, int maxObjects);
+void writeDungeonRmdRow(rmdDungeonStream_t* stream, const rowView_t* rv);
+void closeDungeonRmdStream(rmdDungeonStream_t* stream);
\ No newline at end of file
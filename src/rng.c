@@ -0,0 +1,78 @@
+//==============================================================================
+// Includes
+//==============================================================================
+
+#include "rng.h"
+
+//==============================================================================
+// Functions
+//==============================================================================
+
+/**
+ * @brief Rotate a 64 bit value left
+ *
+ * @param x The value to rotate
+ * @param k The number of bits to rotate by
+ * @return The rotated value
+ */
+static inline uint64_t rotl(const uint64_t x, int k)
+{
+    return (x << k) | (x >> (64 - k));
+}
+
+/**
+ * @brief Seed a generator. The seed is expanded with splitmix64 so that
+ * similar seeds still produce unrelated streams.
+ *
+ * @param rng The generator to seed
+ * @param seed Any 64 bit value, including zero
+ */
+void rngSeed(rng_t* rng, uint64_t seed)
+{
+    for (int i = 0; i < 4; i++)
+    {
+        seed += 0x9E3779B97F4A7C15ULL;
+        uint64_t z = seed;
+        z          = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z          = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        rng->s[i]  = z ^ (z >> 31);
+    }
+}
+
+/**
+ * @brief Get the next random number from a generator
+ *
+ * @param rng The generator to advance
+ * @return A uniformly distributed 64 bit value
+ */
+uint64_t rngNext(rng_t* rng)
+{
+    uint64_t* s           = rng->s;
+    const uint64_t result = rotl(s[1] * 5, 7) * 9;
+    const uint64_t t      = s[1] << 17;
+
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+
+    s[2] ^= t;
+
+    s[3] = rotl(s[3], 45);
+
+    return result;
+}
+
+/**
+ * @brief Get a random number in [0, bound) with a multiply and a shift instead
+ * of a division. The bias is at most bound / 2^32, which is negligible for the
+ * bounds used here
+ *
+ * @param rng The generator to advance
+ * @param bound The exclusive upper bound, must not be zero
+ * @return A random number less than bound
+ */
+uint32_t rngBounded(rng_t* rng, uint32_t bound)
+{
+    return (uint32_t)(((rngNext(rng) >> 32) * bound) >> 32);
+}
@@ -0,0 +1,28 @@
+#ifndef _RNG_H_
+#define _RNG_H_
+
+#include <stdint.h>
+
+//==============================================================================
+// Structs
+//==============================================================================
+
+/**
+ * @brief State for a xoshiro256** pseudo-random number generator. Each
+ * generator owns one so that dungeons can be generated concurrently and
+ * reproduced from a seed.
+ */
+typedef struct
+{
+    uint64_t s[4];
+} rng_t;
+
+//==============================================================================
+// Functions
+//==============================================================================
+
+void rngSeed(rng_t* rng, uint64_t seed);
+uint64_t rngNext(rng_t* rng);
+uint32_t rngBounded(rng_t* rng, uint32_t bound);
+
+#endif
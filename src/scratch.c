@@ -0,0 +1,243 @@
+//==============================================================================
+// Includes
+//==============================================================================
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "scratch.h"
+
+//==============================================================================
+// Defines
+//==============================================================================
+
+// Everything handed out is aligned to a cache line
+#define SCRATCH_ALIGN 64
+#define ALIGN_UP(n)   (((n) + SCRATCH_ALIGN - 1) & ~((size_t)SCRATCH_ALIGN - 1))
+
+//==============================================================================
+// Structs
+//==============================================================================
+
+/**
+ * @brief The header of a request which spilled onto the heap
+ */
+typedef struct spill
+{
+    struct spill* next;
+    size_t size;
+} spill_t;
+
+//==============================================================================
+// Functions
+//==============================================================================
+
+/**
+ * @brief Initialize scratch memory in a block owned by the caller. The block
+ * must outlive the scratch, and isn't freed by freeScratch()
+ *
+ * @param scratch The scratch to initialize
+ * @param mem The block of memory to hand out
+ * @param size The size of the block, in bytes
+ */
+void initScratch(scratch_t* scratch, void* mem, size_t size)
+{
+    scratch->mem        = mem;
+    scratch->size       = size & ~((size_t)SCRATCH_ALIGN - 1);
+    scratch->ownsMem    = false;
+    scratch->used       = 0;
+    scratch->spill      = NULL;
+    scratch->peakSpill  = 0;
+    scratch->spillBytes = 0;
+    scratch->numAllocs  = 0;
+}
+
+/**
+ * @brief Free anything which spilled onto the heap, and the block if the
+ * scratch grew out of the caller's
+ *
+ * @param scratch The scratch to free
+ */
+void freeScratch(scratch_t* scratch)
+{
+    scratchMark_t empty = {0};
+    scratchRelease(scratch, empty);
+    if (scratch->ownsMem)
+    {
+        free(scratch->mem);
+    }
+    scratch->mem     = NULL;
+    scratch->size    = 0;
+    scratch->ownsMem = false;
+}
+
+/**
+ * @brief Get memory from scratch. It is valid until the scratch is released
+ * to a mark taken before this call
+ *
+ * @param scratch The scratch to get memory from
+ * @param size The number of bytes to get
+ * @return The memory, aligned to a cache line, or NULL if it couldn't be allocated
+ */
+void* scratchAlloc(scratch_t* scratch, size_t size)
+{
+    size = ALIGN_UP(size);
+    if (size <= scratch->size - scratch->used)
+    {
+        void* mem = scratch->mem + scratch->used;
+        scratch->used += size;
+        return mem;
+    }
+
+    // Doesn't fit, spill onto the heap
+    spill_t* spill = malloc(ALIGN_UP(sizeof(spill_t)) + size);
+    if (NULL == spill)
+    {
+        fprintf(stderr, "Couldn't allocate %zu bytes of scratch memory!\n", size);
+        return NULL;
+    }
+    spill->next    = scratch->spill;
+    spill->size    = size;
+    scratch->spill = spill;
+    scratch->spillBytes += size;
+    scratch->numAllocs++;
+    if (scratch->spillBytes > scratch->peakSpill)
+    {
+        scratch->peakSpill = scratch->spillBytes;
+    }
+    return (uint8_t*)spill + ALIGN_UP(sizeof(spill_t));
+}
+
+/**
+ * @brief Remember how much scratch memory is in use
+ *
+ * @param scratch The scratch to mark
+ * @return A mark to pass to scratchRelease()
+ */
+scratchMark_t scratchMark(const scratch_t* scratch)
+{
+    scratchMark_t mark = {
+        .used       = scratch->used,
+        .spill      = scratch->spill,
+        .spillBytes = scratch->spillBytes,
+    };
+    return mark;
+}
+
+/**
+ * @brief Give back all scratch memory gotten since a mark was taken. When the
+ * scratch is emptied after something spilled, the block grows so it won't
+ * spill again
+ *
+ * @param scratch The scratch to release
+ * @param mark The mark to release to
+ */
+void scratchRelease(scratch_t* scratch, scratchMark_t mark)
+{
+    while (scratch->spill != mark.spill)
+    {
+        spill_t* next = ((spill_t*)scratch->spill)->next;
+        free(scratch->spill);
+        scratch->spill = next;
+    }
+    scratch->spillBytes = mark.spillBytes;
+    scratch->used       = mark.used;
+
+    // If everything is given back, grow to fit what spilled. If that fails, keep the old block and spill again
+    if (0 == scratch->used && 0 != scratch->peakSpill)
+    {
+        uint8_t* mem = malloc(scratch->size + scratch->peakSpill);
+        if (NULL != mem)
+        {
+            if (scratch->ownsMem)
+            {
+                free(scratch->mem);
+            }
+            scratch->size += scratch->peakSpill;
+            scratch->mem       = mem;
+            scratch->ownsMem   = true;
+            scratch->peakSpill = 0;
+            scratch->numAllocs++;
+        }
+    }
+}
+
+/**
+ * @brief Initialize an empty stack of rooms
+ *
+ * @param stack The stack to initialize
+ * @param scratch The scratch to get memory from
+ * @param cap The number of rooms to make space for
+ * @return true if the stack was initialized, false if its memory couldn't be allocated
+ */
+bool initRoomStack(roomStack_t* stack, scratch_t* scratch, int32_t cap)
+{
+    stack->cap     = (cap > 0) ? cap : 1;
+    stack->rooms   = scratchAlloc(scratch, stack->cap * sizeof(int32_t));
+    stack->len     = 0;
+    stack->scratch = scratch;
+    return NULL != stack->rooms;
+}
+
+/**
+ * @brief Double the capacity of a stack of rooms
+ *
+ * @param stack The stack to grow
+ * @return true if the stack grew, false if it couldn't and is unchanged
+ */
+bool growRoomStack(roomStack_t* stack)
+{
+    int32_t* rooms = scratchAlloc(stack->scratch, 2 * (size_t)stack->cap * sizeof(int32_t));
+    if (NULL == rooms)
+    {
+        return false;
+    }
+    memcpy(rooms, stack->rooms, stack->len * sizeof(int32_t));
+    stack->rooms = rooms;
+    stack->cap *= 2;
+    return true;
+}
+
+/**
+ * @brief Initialize an empty queue of rooms
+ *
+ * @param queue The queue to initialize
+ * @param scratch The scratch to get memory from
+ * @param cap The number of rooms to make space for
+ * @return true if the queue was initialized, false if its memory couldn't be allocated
+ */
+bool initRoomQueue(roomQueue_t* queue, scratch_t* scratch, int32_t cap)
+{
+    queue->cap     = (cap > 0) ? cap : 1;
+    queue->rooms   = scratchAlloc(scratch, queue->cap * sizeof(int32_t));
+    queue->head    = 0;
+    queue->len     = 0;
+    queue->scratch = scratch;
+    return NULL != queue->rooms;
+}
+
+/**
+ * @brief Double the capacity of a queue of rooms, unwrapping it in the process
+ *
+ * @param queue The queue to grow
+ * @return true if the queue grew, false if it couldn't and is unchanged
+ */
+bool growRoomQueue(roomQueue_t* queue)
+{
+    int32_t* rooms = scratchAlloc(queue->scratch, 2 * (size_t)queue->cap * sizeof(int32_t));
+    if (NULL == rooms)
+    {
+        return false;
+    }
+    int32_t first  = queue->cap - queue->head;
+    if (first > queue->len)
+    {
+        first = queue->len;
+    }
+    memcpy(rooms, &queue->rooms[queue->head], first * sizeof(int32_t));
+    memcpy(&rooms[first], queue->rooms, (queue->len - first) * sizeof(int32_t));
+    queue->rooms = rooms;
+    queue->head  = 0;
+    queue->cap *= 2;
+    return true;
+}
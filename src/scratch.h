@@ -0,0 +1,156 @@
+#ifndef _SCRATCH_H_
+#define _SCRATCH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+//==============================================================================
+// Structs
+//==============================================================================
+
+/**
+ * @brief A block of memory handed out in order and given back all at once, so
+ * temporary arrays don't each need a malloc() and free(). If the block runs
+ * out, requests spill onto the heap, and the block grows to fit them the next
+ * time the scratch is emptied.
+ */
+typedef struct
+{
+    uint8_t* mem;
+    /** The size of mem, in bytes */
+    size_t size;
+    /** true once mem has grown out of the caller's block and must be freed */
+    bool ownsMem;
+    /** The number of bytes of mem handed out */
+    size_t used;
+    /** Heap blocks for requests which didn't fit, most recent first */
+    void* spill;
+    /** The most bytes which have spilled onto the heap at once */
+    size_t peakSpill;
+    size_t spillBytes;
+    /** The number of heap allocations made since initScratch() */
+    uint32_t numAllocs;
+} scratch_t;
+
+/**
+ * @brief A point to give scratch memory back to, see scratchMark()
+ */
+typedef struct
+{
+    size_t used;
+    void* spill;
+    size_t spillBytes;
+} scratchMark_t;
+
+/**
+ * @brief A stack of room indices in scratch memory. It grows if pushed past its capacity
+ */
+typedef struct
+{
+    int32_t* rooms;
+    int32_t len;
+    int32_t cap;
+    scratch_t* scratch;
+} roomStack_t;
+
+/**
+ * @brief A first-in first-out ring of room indices in scratch memory. It grows
+ * if pushed past its capacity
+ */
+typedef struct
+{
+    int32_t* rooms;
+    int32_t head;
+    int32_t len;
+    int32_t cap;
+    scratch_t* scratch;
+} roomQueue_t;
+
+//==============================================================================
+// Functions
+//==============================================================================
+
+void initScratch(scratch_t* scratch, void* mem, size_t size);
+void freeScratch(scratch_t* scratch);
+void* scratchAlloc(scratch_t* scratch, size_t size);
+scratchMark_t scratchMark(const scratch_t* scratch);
+void scratchRelease(scratch_t* scratch, scratchMark_t mark);
+
+bool initRoomStack(roomStack_t* stack, scratch_t* scratch, int32_t cap);
+bool growRoomStack(roomStack_t* stack);
+bool initRoomQueue(roomQueue_t* queue, scratch_t* scratch, int32_t cap);
+bool growRoomQueue(roomQueue_t* queue);
+
+//==============================================================================
+// Inline functions
+//==============================================================================
+
+/**
+ * @brief Push a room onto the top of a stack
+ *
+ * @param stack The stack to push onto
+ * @param room The room to push
+ * @return true if the room was pushed, false if the stack was full and couldn't grow
+ */
+static inline bool pushRoom(roomStack_t* stack, int32_t room)
+{
+    if (stack->len == stack->cap && !growRoomStack(stack))
+    {
+        return false;
+    }
+    stack->rooms[stack->len++] = room;
+    return true;
+}
+
+/**
+ * @brief Pop a room from the top of a stack. The stack must not be empty
+ *
+ * @param stack The stack to pop from
+ * @return The room which was on top
+ */
+static inline int32_t popRoom(roomStack_t* stack)
+{
+    return stack->rooms[--stack->len];
+}
+
+/**
+ * @brief Add a room to the back of a queue
+ *
+ * @param queue The queue to add to
+ * @param room The room to add
+ * @return true if the room was added, false if the queue was full and couldn't grow
+ */
+static inline bool enqueueRoom(roomQueue_t* queue, int32_t room)
+{
+    if (queue->len == queue->cap && !growRoomQueue(queue))
+    {
+        return false;
+    }
+    int32_t tail = queue->head + queue->len++;
+    if (tail >= queue->cap)
+    {
+        tail -= queue->cap;
+    }
+    queue->rooms[tail] = room;
+    return true;
+}
+
+/**
+ * @brief Take a room from the front of a queue. The queue must not be empty
+ *
+ * @param queue The queue to take from
+ * @return The room which was at the front
+ */
+static inline int32_t dequeueRoom(roomQueue_t* queue)
+{
+    int32_t room = queue->rooms[queue->head++];
+    if (queue->head == queue->cap)
+    {
+        queue->head = 0;
+    }
+    queue->len--;
+    return room;
+}
+
+#endif